@@ -26,6 +26,10 @@
 #include "inc/hw_nvic.h"
 #include "inc/hw_types.h"
 
+#ifdef STACKCHECK
+#include "stackcheck.h"
+#endif
+
 //*****************************************************************************
 //
 // Forward declaration of the default fault handlers.
@@ -45,6 +49,10 @@ static void IntDefaultHandler(void);
 extern void UARTStdioIntHandler(void);
 #endif
 extern void USB0DeviceIntHandler(void);
+extern void SysTickIntHandler(void);
+#ifdef FASTBOOT
+extern void FastBoot(void);
+#endif
 
 //*****************************************************************************
 //
@@ -55,10 +63,13 @@ extern int main(void);
 
 //*****************************************************************************
 //
-// Reserve space for the system stack.
+// Reserve space for the system stack.  It fills the first 1 kB of SRAM above
+// the two word boot mailbox, so that the uDMA control table after it is aligned
+// without padding, see LM4F.ld.  An overflow runs into the mailbox and then
+// faults below SRAM instead of overwriting data.
 //
 //*****************************************************************************
-static uint32_t pui32Stack[256];
+static uint32_t pui32Stack[254] __attribute__ ((section(".stack")));
 
 //*****************************************************************************
 //
@@ -66,7 +77,7 @@ static uint32_t pui32Stack[256];
 // ensure that it ends up at physical address 0x0000.0000.
 //
 //*****************************************************************************
-__attribute__ ((section(".isr_vector")))
+__attribute__ ((section(".isr_vector"), used)) // Only the linker script refers to it, LTO must keep it
 void (* const g_pfnVectors[])(void) =
 {
     (void (*)(void))((uint32_t)pui32Stack + sizeof(pui32Stack)),
@@ -85,7 +96,7 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // Debug monitor handler
     0,                                      // Reserved
     IntDefaultHandler,                      // The PendSV handler
-    IntDefaultHandler,                      // The SysTick handler
+    SysTickIntHandler,                      // The SysTick handler
     IntDefaultHandler,                      // GPIO Port A
     IntDefaultHandler,                      // GPIO Port B
     IntDefaultHandler,                      // GPIO Port C
@@ -259,6 +270,15 @@ ResetISR(void)
 {
     uint32_t *pui32Src, *pui32Dest;
 
+#ifdef FASTBOOT
+    //
+    // Decide whether to run the bootloader before spending any time on the
+    // data and bss segments. FastBoot() does not return when the application
+    // should be started.
+    //
+    FastBoot();
+#endif
+
     //
     // Copy the data segment initializers from flash to SRAM.
     //
@@ -281,6 +301,18 @@ ResetISR(void)
           "        strlt   r2, [r0], #4\n"
           "        blt     zero_loop");
 
+#ifdef STACKCHECK
+    //
+    // Paint the stack below this frame, stackHighWater() measures how much of
+    // the paint has been overwritten.
+    //
+    __asm volatile("mov %0, sp" : "=r" (pui32Src));
+    for(pui32Dest = pui32Stack; pui32Dest < pui32Src - 8; )
+    {
+        *pui32Dest++ = STACK_PAINT;
+    }
+#endif
+
     //
     // Enable the floating-point unit.  This must be done here to handle the
     // case where main() uses floating-point and the function prologue saves
@@ -373,3 +405,30 @@ void __error__(char __attribute__((unused)) *pcFilename, unsigned long __attribu
   }
 }
 #endif
+
+#ifdef STACKCHECK
+//*****************************************************************************
+//
+// The size of the stack and the most of it that has been used since reset,
+// in bytes.
+//
+//*****************************************************************************
+uint32_t
+stackSize(void)
+{
+    return sizeof(pui32Stack);
+}
+
+uint32_t
+stackHighWater(void)
+{
+    const uint32_t *pui32Word = pui32Stack;
+
+    while(pui32Word < pui32Stack + sizeof(pui32Stack) / 4 &&
+          *pui32Word == STACK_PAINT)
+    {
+        pui32Word++;
+    }
+    return (pui32Stack + sizeof(pui32Stack) / 4 - pui32Word) * 4;
+}
+#endif
@@ -39,6 +39,7 @@
 #include "driverlib/udma.h"
 #include "driverlib/sysctl.h"
 #include "driverlib/hibernate.h"
+#include "driverlib/watchdog.h"
 #include "utils/uartstdio.h"
 
 #include "usblib/usblib.h"
@@ -47,14 +48,31 @@
 #include "usblib/device/usbdmsc.h"
 
 #include "usb_config.h"
+#include "bootctl.h"
 #include "common.h"
+#include "console.h"
 #include "ramdisk.h"
+#include "sched.h"
+
+#ifdef CRC32
+#include "crc32.h"
+#endif
 
 #ifdef CRYPTO
 #include "crypto/crypto.h"
 #endif
 
-tDMAControlTable uDMAControlTable[64] __attribute__ ((aligned(1024)));
+// The usblib bulk transfers use the uDMA channels of USB endpoints 1 to 3, 0 to 5, in basic
+// mode. The controller only reads the primary entries of the channels that are enabled, so
+// the table ends there. It goes first after the stack, see LM4F.ld, which keeps it aligned
+tDMAControlTable uDMAControlTable[UDMA_CHANNEL_USBEP3TX + 1] __attribute__ ((section(".udma")));
+
+// Written by the application before a software reset to request the bootloader. It lives
+// in a section that is not initialized at reset, see BOOT_MAILBOX in common.h
+volatile struct {
+	uint32_t magic;  // BOOT_MAILBOX_MAGIC
+	uint32_t cycles; // BOOT_CYCLES
+} bootMailbox __attribute__ ((section(".noinit")));
 
 uint32_t massStorageEventCallback(void* callback, uint32_t event, uint32_t messageParameters, void* messageData)
 {
@@ -86,23 +104,107 @@ JumpToProgram(unsigned long ulStartAddr)
 	      "    bx      r0\n");
 }
 
-void CallUserProgram()
+// Returns true if the image in the given slot may be booted
+static char checkImage(unsigned long slot)
 {
+#ifdef CRC32
+	if (!checkImageCrc(slot + UPLOAD_CODE_OFFSET, SLOT_LENGTH - UPLOAD_CODE_OFFSET))
+		return 0;
+#endif
 #ifdef CRYPTO
-	if (checkCryptoSignature()) {
+	if (!checkCryptoSignature(slot))
+		return 0;
 #endif
-#ifdef DEBUGUART
-		UARTprintf("Jumping to user program.\n\n");
+#ifdef DUALSLOT
+	// Each image is linked to run from one slot, a signed one for the other slot is refused as well
+	const uint32_t *vectors = (const uint32_t *)(slot + UPLOAD_CODE_OFFSET);
+	return (vectors[0] & 0xFFFC0000) == 0x20000000 && vectors[1] >= slot && vectors[1] < slot + SLOT_LENGTH;
+#else
+	return 1;
+#endif
+}
+
+#ifdef TRIALBOOT
+// Resets the device unless the application disables the reset within TRIAL_TIMEOUT seconds.
+// The watchdog resets on its second time-out, so each period is half of that
+static void StartTrialWatchdog(void)
+{
+	ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_WDOG0);
+	ROM_WatchdogReloadSet(WATCHDOG0_BASE, ROM_SysCtlClockGet() / 2 * TRIAL_TIMEOUT);
+	ROM_WatchdogStallEnable(WATCHDOG0_BASE); // Do not reset while halted in the debugger
+	ROM_WatchdogResetEnable(WATCHDOG0_BASE);
+	ROM_WatchdogEnable(WATCHDOG0_BASE);
+	ROM_WatchdogLock(WATCHDOG0_BASE);
+}
+#endif
+
+void CallUserProgram()
+{
+	unsigned long slot = activeSlot();
+#if defined(DUALSLOT) || defined(TRIALBOOT)
+	unsigned long state = bootState();
+#endif
+	char valid; // checkImage(slot), a signature check takes long enough to do it only once
+
+#ifdef TRIALBOOT
+	if (state == BOOT_TRIAL && (ROM_SysCtlResetCauseGet() & SYSCTL_CAUSE_WDOG0)) {
+		// The image on trial has not confirmed before the watchdog reset
+		ROM_SysCtlResetCauseClear(SYSCTL_CAUSE_WDOG0);
+		state = BOOT_FAILED;
+	}
+#endif
+
+#ifdef DUALSLOT
+	if (newFirmwareStartSet && uploadStart != slot && checkImage(uploadStart)) {
+		// The new image checks out, switch to it. The old one stays as a fallback
+		slot = uploadStart;
+		state = BOOT_NEW;
+		valid = 1;
+	} else {
+		valid = checkImage(slot);
+		if ((state == BOOT_FAILED || !valid) && checkImage(otherSlot(slot))) {
+			// The active image is broken, fall back to the one in the other slot
+			slot = otherSlot(slot);
+			state = BOOT_CONFIRMED;
+			valid = 1;
+		}
+	}
+#elif defined(TRIALBOOT)
+	// The new image has been written over the old one
+	if (newFirmwareStartSet)
+		state = BOOT_NEW;
+#endif
+#if defined(DUALSLOT) || defined(TRIALBOOT)
+	setBootState(slot, state);
+#endif
+
+#ifdef TRIALBOOT
+	if (state == BOOT_FAILED) {
+		// Nothing left to boot, main keeps us in the bootloader until a new image is uploaded
+		ROM_SysCtlReset();
+	}
+#endif
+
+#ifndef DUALSLOT
+	valid = checkImage(slot);
+#endif
+	if (valid) {
+#ifdef DEBUGPRINT
+		consolePrintf("Jumping to user program at 0x%x.\n\n", slot);
 #endif
 		// Shortly blink with green LED to indicate that signature is OK
 		ROM_GPIOPinTypeGPIOOutput(LED_GPIO_BASE, LED_GREEN);
 		ROM_GPIOPinWrite(LED_GPIO_BASE, LED_GREEN, LED_GREEN);
 		ROM_SysCtlDelay(ROM_SysCtlClockGet() / 4 / 8);
 		ROM_GPIOPinWrite(LED_GPIO_BASE, LED_GREEN, 0);
-		JumpToProgram(UPLOAD_CODE_START);
-#ifdef CRYPTO
+		schedStop();
+#ifdef TRIALBOOT
+		if (state == BOOT_TRIAL)
+			StartTrialWatchdog();
+#endif
+		JumpToProgram(slot + UPLOAD_CODE_OFFSET);
 	} else {
-		// Blink the red LED and halt if the crypto signature does not match
+		// Blink the red LED and halt if there is no image that can be booted
 		ROM_GPIOPinTypeGPIOOutput(LED_GPIO_BASE, LED_RED);
 		while (1) {
 			ROM_GPIOPinWrite(LED_GPIO_BASE, LED_RED, LED_RED);
@@ -111,14 +213,94 @@ void CallUserProgram()
 			ROM_SysCtlDelay(ROM_SysCtlClockGet() / 4 / 4);
 		}
 	}
+}
+
+// Blink the blue LED so the user knows we are in bootloader mode
+// The green LED will blink when the new firmware has been programmed
+static void BlinkLed(void)
+{
+	static bool on = false;
+#ifdef CRC32
+	const uint32_t led = uploadVerified ? LED_GREEN : LED_BLUE;
+#else
+	const uint32_t led = newFirmwareStartSet ? LED_GREEN : LED_BLUE; // TODO: Use different flag
 #endif
+	on = !on;
+	ROM_GPIOPinWrite(LED_GPIO_BASE, LED_GREEN | LED_BLUE, on ? led : 0);
 }
 
-int main(void)
+// Returns true once if the application has requested the bootloader through the mailbox
+static bool MailboxRequested(void)
+{
+	if (bootMailbox.magic != BOOT_MAILBOX_MAGIC)
+		return false;
+	bootMailbox.magic = 0;
+	return true;
+}
+
+static void ConfigureButtons(void)
 {
-	// We are waking from hibernation, jump to the user program
+    ROM_SysCtlPeripheralEnable(BTN_GPIO_PERIPH);
+
+#if BTN_GPIO_PERIPH == SYSCTL_PERIPH_GPIOF && (BTN_LEFT == GPIO_PIN_0 || BTN_RIGHT == GPIO_PIN_0)
+    HWREG(GPIO_PORTF_BASE + GPIO_O_LOCK) = GPIO_LOCK_KEY; // Unlocks the GPIO_CR register
+    HWREG(GPIO_PORTF_BASE + GPIO_O_CR) |= GPIO_PIN_0; // Allow changes to PF0
+    HWREG(GPIO_PORTF_BASE + GPIO_O_LOCK) = 0; // Lock register again
+#endif
+
+	ROM_GPIODirModeSet(BTN_GPIO_BASE, BTN_LEFT | BTN_RIGHT,  GPIO_DIR_MODE_IN);
+	ROM_GPIOPadConfigSet(BTN_GPIO_BASE, BTN_LEFT | BTN_RIGHT,  GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+}
+
+#ifdef FASTBOOT
+// Starts the application from FastBoot. A DEBUG build leaves the cycles since reset for it.
+static void FastJump(void)
+{
+#ifdef DEBUG
+	bootMailbox.cycles = HWREG(DWT_CYCCNT);
+#endif
+	JumpToProgram(activeSlot() + UPLOAD_CODE_OFFSET);
+}
+
+// Called by ResetISR before the data and bss segments are initialized, so only the
+// stack, constants and ROM functions may be used here. Returns only if the
+// bootloader should run.
+void FastBoot(void)
+{
+#ifdef DEBUG
+	// Count cycles from here, FastJump leaves the count at BOOT_CYCLES
+	HWREG(DEMCR) |= DEMCR_TRCENA;
+	HWREG(DWT_CYCCNT) = 0;
+	HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+#endif
+
+	// The application asked for an update
+	if (MailboxRequested())
+		return;
+
+	// We are waking from hibernation, jump to the user program. There is no trial to keep
+	// track of, the Makefile does not allow FASTBOOT with TRIALBOOT or DUALSLOT
 	if (HWREG(HIB_RIS) & HIBERNATE_INT_PIN_WAKE)
-	    JumpToProgram(UPLOAD_CODE_START);
+	    FastJump();
+
+	// Sample the buttons on the reset clock, skipping the PLL setup and the LED blink
+	ConfigureButtons();
+	if (ROM_GPIOPinRead(BTN_GPIO_BASE, BTN_LEFT | BTN_RIGHT))
+	    FastJump();
+}
+#endif
+
+int main(void)
+{
+#ifndef FASTBOOT
+	// The application can ask for an update, otherwise a wake from hibernation or the buttons decide below
+#ifdef TRIALBOOT
+	// After a failed trial we also stay in the bootloader until a new image is uploaded
+	const bool updateRequested = MailboxRequested() || bootState() == BOOT_FAILED;
+#else
+	const bool updateRequested = MailboxRequested();
+#endif
+#endif
 
 	// Set the clocking to run directly from the external crystal/oscillator and use PLL to run at 80 MHz
     ROM_SysCtlClockSet(SYSCTL_SYSDIV_2_5 | SYSCTL_USE_PLL | SYSCTL_OSC_MAIN | SYSCTL_XTAL_16MHZ); // Set clock to 80 MHz (400 MHz(PLL) / 2 / 2.5 = 80 MHz)
@@ -129,26 +311,20 @@ int main(void)
 	ROM_GPIOPinConfigure(GPIO_PA0_U0RX);
 	ROM_GPIOPinConfigure(GPIO_PA1_U0TX);
 	ROM_GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
-	UARTStdioConfig(0, 115200, SysCtlClockGet()); // Mode is set to 8N1 on UART1
+	UARTStdioConfig(0, 115200, ROM_SysCtlClockGet()); // Mode is set to 8N1 on UART1
     UARTEchoSet(false);
 #endif
 
     // Setup GPIO for buttons
     ROM_SysCtlPeripheralEnable(LED_GPIO_PERIPH);
-    ROM_SysCtlPeripheralEnable(BTN_GPIO_PERIPH);
-
-#if BTN_GPIO_PERIPH == SYSCTL_PERIPH_GPIOF && (BTN_LEFT == GPIO_PIN_0 || BTN_RIGHT == GPIO_PIN_0)
-    HWREG(GPIO_PORTF_BASE + GPIO_O_LOCK) = GPIO_LOCK_KEY; // Unlocks the GPIO_CR register
-    HWREG(GPIO_PORTF_BASE + GPIO_O_CR) |= GPIO_PIN_0; // Allow changes to PF0
-    HWREG(GPIO_PORTF_BASE + GPIO_O_LOCK) = 0; // Lock register again
-#endif
-
-	ROM_GPIODirModeSet(BTN_GPIO_BASE, BTN_LEFT | BTN_RIGHT,  GPIO_DIR_MODE_IN);
-	ROM_GPIOPadConfigSet(BTN_GPIO_BASE, BTN_LEFT | BTN_RIGHT,  GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+    ConfigureButtons();
 
-	// If one of the buttons is not pressed, jump to the user program
-	if (ROM_GPIOPinRead(BTN_GPIO_BASE, BTN_LEFT | BTN_RIGHT))
+#ifndef FASTBOOT
+	// If we are waking from hibernation or one of the buttons is not pressed, jump to the
+	// user program. Both go through the image check and the trial handling
+	if (!updateRequested && ((HWREG(HIB_RIS) & HIBERNATE_INT_PIN_WAKE) || ROM_GPIOPinRead(BTN_GPIO_BASE, BTN_LEFT | BTN_RIGHT)))
 	    CallUserProgram();
+#endif
 
 	// Both buttons pressed, start up the bootloader ...
 
@@ -173,20 +349,15 @@ int main(void)
     USBStackModeSet(0, eUSBModeForceDevice, 0);
 
 	// Pass our device information to the USB library and place the device on the bus
-	USBDMSCInit(0, &massStorageDevice);
+	usbDeviceInit();
 
-#ifdef DEBUGUART
-	UARTprintf("Bootloader started\n\n");
+#ifdef DEBUGPRINT
+	consolePrintf("Bootloader started\n\n");
 #endif
 
 	ROM_GPIOPinTypeGPIOOutput(LED_GPIO_BASE, LED_GREEN | LED_BLUE);
-	while(1) {
-	    // Blink the blue LED so the user knows we are in bootloader mode
-	    // The green LED will blink when the new firmware has been programmed
-	    const uint32_t led = newFirmwareStartSet ? LED_GREEN : LED_BLUE; // TODO: Use different flag
-	    ROM_GPIOPinWrite(LED_GPIO_BASE, LED_GREEN | LED_BLUE, led);
-	    ROM_SysCtlDelay(ROM_SysCtlClockGet() / 4 / 2);
-        ROM_GPIOPinWrite(LED_GPIO_BASE, LED_GREEN | LED_BLUE, 0);
-        ROM_SysCtlDelay(ROM_SysCtlClockGet() / 4 / 2);
-	}
+	schedEvery(BlinkLed, 500);
+
+	// Everything else happens in interrupt handlers and the tasks they queue
+	schedRun();
 }
@@ -26,5 +26,8 @@
 #define __BOOT_USB_MSC_H__
 
 void CallUserProgram(void);
+#ifdef FASTBOOT
+void FastBoot(void);
+#endif
 
 #endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bootctl.h"
+
+#include "inc/hw_types.h"
+#include "driverlib/flash.h"
+#include "driverlib/rom.h"
+
+#if defined(DUALSLOT) || defined(TRIALBOOT)
+
+// The boot control pages hold a log of records, one word each. The last valid record
+// names the active slot and its state. Changing either appends a record, so the switch
+// is a single word program. The application appends BOOTCTL_CONFIRM to end a trial.
+// The log is kept in one of two pages, the one with the newer header. When it is full,
+// the log starts over in the other page with the new record and only then its header,
+// so a reset while the log moves leaves the old page in charge.
+#define RECORD_MAGIC      (0xB0070000)
+#define HEADER_MAGIC      (0xB0060000)
+#define MAGIC_MASK        (0xFFFF0000)
+#define RECORD_SLOT_B     (0x00000001)
+#define RECORD_CONFIRM    (0x00000080)
+#define RECORD_ERASED     (0xFFFFFFFF)
+#define PAGE_LENGTH       (BOOTCTL_LENGTH / 2)
+#define RECORDS           (PAGE_LENGTH / sizeof(uint32_t)) // Including the header
+
+// The low byte is repeated inverted, programming only clears bits so a record cut
+// short by a reset can not pass for a different one. The low byte of a header is the
+// sequence number of its page, one more than that of the page before.
+#define CHECKED(magic, bits)        ((magic) | ((~(bits) & 0xFF) << 8) | ((bits) & 0xFF))
+#define CHECKED_VALID(magic, word)  (((word) & MAGIC_MASK) == (magic) && (((word) >> 8) & 0xFF) == (~(word) & 0xFF))
+#define RECORD(bits)                CHECKED(RECORD_MAGIC, bits)
+#define RECORD_VALID(record)        CHECKED_VALID(RECORD_MAGIC, record)
+#define HEADER(sequence)            CHECKED(HEADER_MAGIC, sequence)
+#define HEADER_VALID(header)        CHECKED_VALID(HEADER_MAGIC, header)
+
+// Returns the page that holds the log, 0 if the log has not been started in either
+static const uint32_t *logPage(void)
+{
+	const uint32_t *first = (const uint32_t *)BOOTCTL_START;
+	const uint32_t *second = (const uint32_t *)(BOOTCTL_START + PAGE_LENGTH);
+
+	if (!HEADER_VALID(first[0]))
+		return HEADER_VALID(second[0]) ? second : 0;
+	if (!HEADER_VALID(second[0]))
+		return first;
+	return (uint8_t)(second[0] - first[0]) == 1 ? second : first;
+}
+
+// Returns the slot and state bits of the last record.
+// Does not use any static data, it is called by FastBoot before the data and bss segments are set up
+static uint32_t lastRecord(void)
+{
+	const uint32_t *records = logPage();
+	uint32_t last = 0; // Slot A, confirmed
+	for (int i = 1; records && i < RECORDS && records[i] != RECORD_ERASED; i++) {
+		if (!RECORD_VALID(records[i]))
+			continue;
+		if (records[i] & RECORD_CONFIRM)
+			last &= ~BOOT_TRIAL;
+		else
+			last = records[i] & 0xFF;
+	}
+	return last;
+}
+
+unsigned long bootState(void)
+{
+	return lastRecord() & (BOOT_TRIAL | BOOT_FAILED);
+}
+
+#ifdef DUALSLOT
+unsigned long activeSlot(void)
+{
+	return (lastRecord() & RECORD_SLOT_B) ? SLOT_B_START : SLOT_A_START;
+}
+#endif
+
+void setBootState(unsigned long slot, unsigned long state)
+{
+	const uint32_t *records = logPage();
+#ifdef DUALSLOT
+	const uint32_t bits = (slot == SLOT_B_START ? RECORD_SLOT_B : 0) | state;
+#else
+	const uint32_t bits = state;
+#endif
+	uint32_t record = RECORD(bits);
+	int next = 1;
+
+	if (lastRecord() == bits)
+		return;
+
+	while (records && next < RECORDS && records[next] != RECORD_ERASED)
+		next++;
+	// Always leave a word for the application to confirm a trial
+	if (!records || next + 1 >= RECORDS) {
+		const unsigned long spare = records == (const uint32_t *)BOOTCTL_START ? BOOTCTL_START + PAGE_LENGTH : BOOTCTL_START;
+		uint32_t header = HEADER(records ? records[0] + 1 : 0);
+		ROM_FlashErase(spare);
+		ROM_FlashProgram(&record, spare + sizeof(uint32_t), sizeof(record));
+		ROM_FlashProgram(&header, spare, sizeof(header));
+		return;
+	}
+	ROM_FlashProgram(&record, (unsigned long)&records[next], sizeof(record));
+}
+#endif
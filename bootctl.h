@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef __BOOTCTL_H__
+#define __BOOTCTL_H__
+
+#include "common.h"
+
+#if defined(DUALSLOT) || defined(TRIALBOOT)
+// States of the image to boot
+#define BOOT_CONFIRMED (0x00000000) // Known to work
+#define BOOT_TRIAL     (0x00000002) // Booted with the watchdog armed, the application has not confirmed yet
+#define BOOT_FAILED    (0x00000004) // The watchdog reset the trial, do not boot it again
+#ifdef TRIALBOOT
+#define BOOT_NEW       BOOT_TRIAL       // Uploaded images have to prove themselves
+#else
+#define BOOT_NEW       BOOT_CONFIRMED
+#endif
+unsigned long bootState(void);
+// Boot the image at the given slot in the given state from now on, a single word is programmed so this is atomic,
+// also when the log moves to the other page
+void setBootState(unsigned long slot, unsigned long state);
+#endif
+
+#ifdef DUALSLOT
+// Start address of the image to boot
+unsigned long activeSlot(void);
+#define otherSlot(slot) ((slot) == SLOT_A_START ? SLOT_B_START : SLOT_A_START)
+// New images are uploaded into the slot that is not booted
+#define uploadSlot() otherSlot(activeSlot())
+#else
+#define activeSlot() (UPLOAD_START)
+#define uploadSlot() (UPLOAD_START)
+#endif
+
+#endif
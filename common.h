@@ -36,14 +36,62 @@
 #define LED_BLUE        (GPIO_PIN_2)
 #define LED_GREEN       (GPIO_PIN_3)
 
-#define UPLOAD_START  (0x6000)
-#define UPLOAD_LENGTH (0x40000 - UPLOAD_START)
+// Cycle counter, used to measure the reset-to-app time with FASTBOOT in a DEBUG build
+#define DEMCR              (0xE000EDFC)
+#define DEMCR_TRCENA       (0x01000000)
+#define DWT_CTRL           (0xE0001000)
+#define DWT_CTRL_CYCCNTENA (0x00000001)
+#define DWT_CYCCNT         (0xE0001004)
+
+// The application enters the bootloader by writing BOOT_MAILBOX_MAGIC to BOOT_MAILBOX
+// and doing a software reset, see README.md. With FASTBOOT in a DEBUG build, the word
+// after it holds the cycles from reset to the jump into the application.
+#define BOOT_MAILBOX       (0x20000000)
+#define BOOT_MAILBOX_MAGIC (0x544F4F42) // "BOOT"
+#define BOOT_CYCLES        (0x20000004)
+
+// The host simulation maps its flash elsewhere, see sim/README
+#ifndef FLASH_BASE
+#define FLASH_BASE (0x0)
+#endif
+#define FLASH_SIZE (0x40000)
+
+// Where the application starts, set by APP_START in the Makefile, which also hands it to
+// the linker script as _app_start. The bootloader must fit below the boot control pages.
+#ifndef APP_START
+#define APP_START (0x6000)
+#endif
+#define UPLOAD_START  (FLASH_BASE + APP_START)
+#define UPLOAD_LENGTH (FLASH_BASE + FLASH_SIZE - UPLOAD_START)
+
+// The two flash pages just below UPLOAD_START record which slot is booted with DUALSLOT
+// and whether the image is still on trial with TRIALBOOT
+#define BOOTCTL_LENGTH (0x800)
+#define BOOTCTL_START  (UPLOAD_START - BOOTCTL_LENGTH)
+
+// With TRIALBOOT a new image has TRIAL_TIMEOUT seconds to append BOOTCTL_CONFIRM to
+// the boot control log and disable the watchdog reset, see README.md
+#define TRIAL_TIMEOUT   (8)
+#define BOOTCTL_CONFIRM (0xB0077F80)
+
+#ifdef DUALSLOT
+#if (FLASH_SIZE - APP_START) % 0x800
+#error "With DUALSLOT, both slots must be whole flash pages: FLASH_SIZE - APP_START must be a multiple of 2 kB"
+#endif
+// Two images, each linked to run from its own slot
+#define SLOT_LENGTH  (UPLOAD_LENGTH / 2)
+#define SLOT_A_START (UPLOAD_START)
+#define SLOT_B_START (UPLOAD_START + SLOT_LENGTH)
+#else
+#define SLOT_LENGTH  (UPLOAD_LENGTH)
+#endif
 
 #ifdef CRYPTO
 #define UPLOAD_HEADER_LENGTH (32)
-#define UPLOAD_CODE_START (UPLOAD_START + UPLOAD_HEADER_LENGTH)
+#define UPLOAD_CODE_OFFSET (UPLOAD_HEADER_LENGTH)
 #else
-#define UPLOAD_CODE_START (UPLOAD_START)
+#define UPLOAD_CODE_OFFSET (0)
 #endif
+#define UPLOAD_CODE_START (UPLOAD_START + UPLOAD_CODE_OFFSET)
 
 #endif
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "console.h"
+
+#ifdef DEBUGUART
+#include "utils/uartstdio.h"
+#endif
+
+#ifdef CONSOLE
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/rom.h"
+#include "usblib/usblib.h"
+#include "usblib/usbcdc.h"
+#include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdcomp.h"
+#include "usblib/device/usbdmsc.h"
+
+#include "usb_config.h"
+#include "bootctl.h"
+#include "common.h"
+#include "crc32.h"
+#include "ramdisk.h"
+#include "sched.h"
+
+#ifdef STACKCHECK
+#include "stackcheck.h"
+#endif
+
+#define CONSOLE_LINE_LENGTH 128 // Longer messages are cut off
+
+// Messages wait here until the host reads them, the USB interrupt sends them
+static uint8_t txData[512];
+static uint8_t rxData[64];
+static bool consoleReady;          // The buffers are set up
+static uint32_t consoleDropped;    // Bytes of messages that did not fit
+static char command[16];           // The query being typed
+static unsigned int commandLength;
+
+static tLineCoding lineCoding = { 115200, USB_CDC_STOP_BITS_1, USB_CDC_PARITY_NONE, 8 };
+
+static uint32_t consoleRxEvent(void *callbackData, uint32_t event, uint32_t messageValue, void *messageData);
+static uint32_t consoleTxEvent(void *callbackData, uint32_t event, uint32_t messageValue, void *messageData);
+
+tUSBBuffer consoleTxBuffer = {
+	.bTransmitBuffer = true,
+	.pfnCallback = consoleTxEvent,
+	.pvCBData = &consoleDevice,
+	.pfnTransfer = USBDCDCPacketWrite,
+	.pfnAvailable = USBDCDCTxPacketAvailable,
+	.pvHandle = &consoleDevice,
+	.pui8Buffer = txData,
+	.ui32BufferSize = sizeof(txData),
+};
+
+tUSBBuffer consoleRxBuffer = {
+	.bTransmitBuffer = false,
+	.pfnCallback = consoleRxEvent,
+	.pvCBData = &consoleDevice,
+	.pfnTransfer = USBDCDCPacketRead,
+	.pfnAvailable = USBDCDCRxPacketAvailable,
+	.pvHandle = &consoleDevice,
+	.pui8Buffer = rxData,
+	.ui32BufferSize = sizeof(rxData),
+};
+
+// A line being formatted
+typedef struct {
+	char *data;
+	unsigned int size;
+	unsigned int length;
+} Line;
+
+static void linePut(Line *line, char c)
+{
+	if (line->length < line->size)
+		line->data[line->length++] = c;
+}
+
+static void linePutNumber(Line *line, uint32_t value, unsigned int base, bool negative, unsigned int width, char pad)
+{
+	char digits[10];
+	unsigned int count = 0;
+
+	do {
+		digits[count++] = "0123456789abcdef"[value % base];
+		value /= base;
+	} while (value);
+	if (negative) {
+		width = width ? width - 1 : 0;
+		if (pad == '0')
+			linePut(line, '-');
+	}
+	for (; width > count; width--)
+		linePut(line, pad);
+	if (negative && pad != '0')
+		linePut(line, '-');
+	while (count)
+		linePut(line, digits[--count]);
+}
+
+// The formats of UARTprintf: %c %d %i %p %s %u %x %X and %%, with an optional width that
+// pads with spaces or, after a 0, with zeros. Hex digits are lower case as there.
+static void lineFormat(Line *line, const char *format, va_list arguments)
+{
+	for (; *format; format++) {
+		if (*format != '%') {
+			// Terminals want both
+			if (*format == '\n')
+				linePut(line, '\r');
+			linePut(line, *format);
+			continue;
+		}
+		format++;
+		const char pad = *format == '0' ? '0' : ' ';
+		unsigned int width = 0;
+		while (*format >= '0' && *format <= '9')
+			width = width * 10 + *format++ - '0';
+
+		switch (*format) {
+		case 'c':
+			linePut(line, va_arg(arguments, int));
+			break;
+		case 'd':
+		case 'i': {
+			const int32_t value = va_arg(arguments, int32_t);
+			linePutNumber(line, value < 0 ? -(uint32_t)value : value, 10, value < 0, width, pad);
+			break;
+		}
+		case 'u':
+			linePutNumber(line, va_arg(arguments, uint32_t), 10, false, width, pad);
+			break;
+		case 'p':
+		case 'x':
+		case 'X':
+			linePutNumber(line, va_arg(arguments, uint32_t), 16, false, width, pad);
+			break;
+		case 's': {
+			const char *string = va_arg(arguments, const char *);
+			unsigned int length = strlen(string);
+			for (; width > length; width--)
+				linePut(line, ' ');
+			while (*string)
+				linePut(line, *string++);
+			break;
+		}
+		case '%':
+			linePut(line, '%');
+			break;
+		case '\0':
+			return;
+		default:
+			linePut(line, '?');
+			break;
+		}
+	}
+}
+
+// Queues the whole message or, if it does not fit, none of it. Also from the USB interrupt
+static void consoleWrite(const char *data, unsigned int length)
+{
+	if (!consoleReady)
+		return;
+	const bool masked = ROM_IntMasterDisable();
+	if (USBBufferSpaceAvailable(&consoleTxBuffer) >= length)
+		USBBufferWrite(&consoleTxBuffer, (const uint8_t *)data, length);
+	else
+		consoleDropped += length;
+	if (!masked)
+		ROM_IntMasterEnable();
+}
+
+#if defined(DUALSLOT) || defined(TRIALBOOT)
+static const char *bootStateName(unsigned long state)
+{
+	switch (state) {
+	case BOOT_CONFIRMED:
+		return "confirmed";
+	case BOOT_TRIAL:
+		return "on trial";
+	case BOOT_FAILED:
+		return "failed";
+	}
+	return "unknown";
+}
+#endif
+
+static void consoleStatus(void)
+{
+	consolePrintf("Running 0x%08x, uploads go to 0x%08x\n", activeSlot(), uploadSlot());
+#if defined(DUALSLOT) || defined(TRIALBOOT)
+	consolePrintf("Boot state: %s\n", bootStateName(bootState()));
+#endif
+	if (!newFirmwareStartSet) {
+		consolePrintf("No upload yet\n");
+		return;
+	}
+	consolePrintf("Upload to 0x%08x: %u blocks programmed\n", uploadStart, uploadStats.blocksProgrammed);
+#ifdef CRC32
+	consolePrintf("Image CRC32 %s\n", uploadVerified ? "matches" : "not checked yet");
+#endif
+}
+
+static void consoleHash(void)
+{
+	uploadFlush();
+	consolePrintf("CRC32 of the slot at 0x%08x: %08x\n", activeSlot(), crc32Update(0, (const void *)activeSlot(), SLOT_LENGTH));
+	if (uploadSlot() != activeSlot())
+		consolePrintf("CRC32 of the slot at 0x%08x: %08x\n", uploadSlot(), crc32Update(0, (const void *)uploadSlot(), SLOT_LENGTH));
+}
+
+static void consoleStats(void)
+{
+	const uint32_t bytes = uploadStats.blocksProgrammed * BLOCK_SIZE;
+	const uint32_t ticks = uploadStats.lastBlockTicks - uploadStats.firstBlockTicks;
+
+	consolePrintf("Blocks read %u, written %u, kept out of flash %u, programmed %u\n",
+	              uploadStats.blocksRead, uploadStats.blocksWritten, uploadStats.metadataBlocks, uploadStats.blocksProgrammed);
+	consolePrintf("Write queue: max depth %u, max latency %u ms\n",
+	              uploadStats.queueMaxDepth, uploadStats.queueMaxLatency * 1000 / SCHED_TICK_HZ);
+	if (ticks)
+		consolePrintf("Programmed %u bytes in %u ms, %u kB/s\n", bytes, ticks * 1000 / SCHED_TICK_HZ, bytes / ticks * SCHED_TICK_HZ / 1024);
+	consolePrintf("Console bytes dropped: %u\n", consoleDropped);
+}
+
+#ifdef STACKCHECK
+static void consoleMemory(void)
+{
+	consolePrintf("Stack: %u of %u bytes used\n", stackHighWater(), stackSize());
+#ifdef CRYPTO
+	consolePrintf("Heap: %u bytes at most\n", heapPeak);
+#endif
+}
+#endif
+
+static void consoleHelp(void);
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+	const char *help;
+} commands[] = {
+	{ "status", consoleStatus, "slots, boot state and the upload so far" },
+	{ "hash",   consoleHash,   "CRC32 of the slots" },
+	{ "stats",  consoleStats,  "transfer, write queue and throughput counters" },
+#ifdef STACKCHECK
+	{ "memory", consoleMemory, "stack high-water mark and heap peak" },
+#endif
+	{ "help",   consoleHelp,   "this list" },
+};
+
+static void consoleHelp(void)
+{
+	for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+		consolePrintf("%6s  %s\n", commands[i].name, commands[i].help);
+}
+
+// Runs from the main loop, the queries take their time (hash) but never block the USB interrupt
+static void consoleInput(void)
+{
+	uint8_t c;
+
+	while (USBBufferRead(&consoleRxBuffer, &c, 1)) {
+		if (c != '\r' && c != '\n') {
+			if (commandLength < sizeof(command) - 1)
+				command[commandLength++] = c;
+			consoleWrite((const char *)&c, 1);
+			continue;
+		}
+		if (!commandLength)
+			continue;
+		command[commandLength] = '\0';
+		commandLength = 0;
+		consoleWrite("\r\n", 2);
+
+		unsigned int i = 0;
+		while (i < sizeof(commands) / sizeof(commands[0]) && strcmp(command, commands[i].name) != 0)
+			i++;
+		if (i < sizeof(commands) / sizeof(commands[0]))
+			commands[i].run();
+		else
+			consolePrintf("Unknown query, try help\n");
+	}
+}
+
+static uint32_t consoleRxEvent(void *callbackData, uint32_t event, uint32_t messageValue, void *messageData)
+{
+	if (event == USB_EVENT_RX_AVAILABLE)
+		schedPost(consoleInput);
+	return 0;
+}
+
+static uint32_t consoleTxEvent(void *callbackData, uint32_t event, uint32_t messageValue, void *messageData)
+{
+	return 0;
+}
+
+uint32_t consoleControlCallback(void *callbackData, uint32_t event, uint32_t messageValue, void *messageData)
+{
+	switch (event) {
+	case USBD_CDC_EVENT_GET_LINE_CODING:
+		*(tLineCoding *)messageData = lineCoding;
+		break;
+	case USBD_CDC_EVENT_SET_LINE_CODING:
+		// There is no UART behind the console, the setting is only kept for the host
+		lineCoding = *(tLineCoding *)messageData;
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+void *consoleCompositeInit(tCompositeEntry *compositeEntry)
+{
+	USBBufferInit(&consoleTxBuffer);
+	USBBufferInit(&consoleRxBuffer);
+	consoleReady = true;
+	return USBDCDCCompositeInit(0, &consoleDevice, compositeEntry);
+}
+#endif
+
+void consolePrintf(const char *format, ...)
+{
+	va_list arguments;
+
+#ifdef DEBUGUART
+	va_start(arguments, format);
+	UARTvprintf(format, arguments);
+	va_end(arguments);
+#endif
+#ifdef CONSOLE
+	char data[CONSOLE_LINE_LENGTH];
+	Line line = { data, sizeof(data), 0 };
+
+	va_start(arguments, format);
+	lineFormat(&line, format, arguments);
+	va_end(arguments);
+	consoleWrite(line.data, line.length);
+#endif
+}
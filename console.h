@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+// Diagnostic messages, built in with DEBUGUART or CONSOLE, which both define DEBUGPRINT.
+// consolePrintf takes the formats of UARTprintf and sends the message to the UART with
+// DEBUGUART and to the USB serial console with CONSOLE, a CDC-ACM interface next to mass
+// storage that also answers one line queries ("help" lists them). The console never
+// waits for the host: a message that does not fit into its buffer is dropped and counted.
+extern void consolePrintf(const char *format, ...);
+
+#endif
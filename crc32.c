@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "crc32.h"
+#include "common.h"
+
+#ifdef DEBUGPRINT
+#include "inc/hw_types.h"
+#include "console.h"
+#endif
+
+// Slice-by-4: four bytes are folded per step through four tables, 4 kB in SRAM.
+// SRAM has no wait states, unlike flash at 80 MHz, and the tables are built on first use.
+static uint32_t table[4][256];
+
+static void crc32Init(void)
+{
+	for (int i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		table[0][i] = crc;
+	}
+	for (int i = 0; i < 256; i++) {
+		for (int k = 1; k < 4; k++)
+			table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+	}
+}
+
+uint32_t crc32Update(uint32_t crc, const void *data, unsigned long length)
+{
+	const unsigned char *p = data;
+
+	if (table[0][1] == 0)
+		crc32Init();
+
+	crc = ~crc;
+	while (length && ((unsigned long)p & 3)) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+		length--;
+	}
+	// Little endian, the first byte of each word is in the low bits
+	for (; length >= 4; length -= 4, p += 4) {
+		crc ^= *(const uint32_t *)p;
+		crc = table[3][crc & 0xFF] ^ table[2][(crc >> 8) & 0xFF] ^ table[1][(crc >> 16) & 0xFF] ^ table[0][crc >> 24];
+	}
+	while (length--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+	return ~crc;
+}
+
+bool checkImageCrc(unsigned long start, unsigned long maxLength)
+{
+	const uint32_t *stamp = (const uint32_t *)(start + IMAGE_CRC_OFFSET);
+	const uint32_t length = stamp[1];
+	uint32_t crc;
+
+	if (stamp[0] != IMAGE_CRC_MAGIC || length < IMAGE_CRC_END || length > maxLength)
+		return false;
+
+#ifdef DEBUGPRINT
+	// Time the check with the cycle counter
+	HWREG(DEMCR) |= DEMCR_TRCENA;
+	HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+	const uint32_t cycles = HWREG(DWT_CYCCNT);
+#endif
+	crc = crc32Update(0, (const void *)start, IMAGE_CRC_OFFSET);
+	crc = crc32Update(crc, (const void *)(start + IMAGE_CRC_END), length - IMAGE_CRC_END);
+#ifdef DEBUGPRINT
+	consolePrintf("CRC32 of %u bytes took %u cycles\n", length, HWREG(DWT_CYCCNT) - cycles);
+#endif
+	return crc == stamp[2];
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Images are stamped by tools/crc-stamp with a magic, their length and their CRC32 in
+// the vector table entries 7 to 9, which are reserved on the Cortex-M4. The CRC covers
+// the whole image except these three words.
+#define IMAGE_CRC_OFFSET (0x1C)
+#define IMAGE_CRC_END    (0x28)
+#define IMAGE_CRC_MAGIC  (0x32335243) // "CR32"
+
+// Same convention as zlib's crc32(), start with 0 and pass the result of the previous call
+uint32_t crc32Update(uint32_t crc, const void *data, unsigned long length);
+// Returns true if the image at start is stamped, fits in maxLength and its CRC32 matches
+bool checkImageCrc(unsigned long start, unsigned long maxLength);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __AES_H__
+#define __AES_H__
+
+typedef struct {
+    unsigned int rk[60];
+    int rounds;
+} AES_State;
+int AES_Init(AES_State * s, const unsigned char *key, int keybits);
+void AES_Encrypt(const AES_State * s, const unsigned char *in, unsigned char *out);
+void AES_CTR(const AES_State * s, const unsigned char *iv, unsigned long offset, unsigned char *p, unsigned long len);
+
+#endif
@@ -22,25 +22,275 @@
  *
  */
 
+#include <stdint.h>
+#include <string.h>
+
 #include "crypto.h"
 #include "rsa.h"
+#include "sha256.h"
 #include "../common.h"
 
-#ifdef DEBUGUART
-#include "utils/uartstdio.h"
+#include "inc/hw_flash.h"
+
+#ifdef ENCRYPT
+#include "aes.h"
+#include "delta.h"
+#endif
+
+#ifdef DEBUGPRINT
+#include "inc/hw_types.h"
+#include "../console.h"
+#endif
+
+#define HASH_SIZE 32
+#define TABLE_BLOCK_SIZE 512 // The page table and signature of FORMAT_PAGES are padded to whole upload blocks
+
+enum {
+	HASH_IDLE,    // No upload seen yet
+	HASH_RUNNING, // Header parsed, code is being hashed as it arrives
+	HASH_DONE,    // uploadDigest holds the digest covered by the signature
+	HASH_INVALID, // Blocks arrived out of order, hash the flash instead
+	HASH_BAD,     // A page does not match the page table, the image is refused
+};
+
+static SHA256_State uploadHash;      // Whole code, or the current page with FORMAT_PAGES
+static SHA256_State uploadTableHash; // Page hashes computed so far with FORMAT_PAGES
+static unsigned char uploadDigest[HASH_SIZE];
+static unsigned long uploadHashStart;   // Where the image being hashed is programmed
+static unsigned long uploadHashOffset;  // Next offset from uploadHashStart expected by the hash
+static unsigned long uploadCodeEnd;     // Offset from uploadHashStart where the code ends
+static unsigned long uploadPageSize;    // 0 for FORMAT_IMAGE
+static unsigned long uploadTableLength; // What comes ahead of the code in a FORMAT_PAGES file
+static unsigned long uploadTableOffset; // Next offset expected after the code with FORMAT_PAGES
+static char uploadHashState = HASH_IDLE;
+
+static unsigned long headerCodeSize(const unsigned char *header)
+{
+	return header[2] + (header[3] << 8) + (header[4] << 16) + ((unsigned long)header[5] << 24);
+}
+
+// Returns the page size for the format in the header, 0 for FORMAT_IMAGE and 1 if the header is invalid
+static unsigned long headerPageSize(const unsigned char *header)
+{
+	if (header[8] == FORMAT_IMAGE)
+		return 0;
+	// The pages are the flash pages of the slot, and the code ends on a page boundary
+	if (header[8] == FORMAT_PAGES && header[9] < 32 && (1UL << header[9]) == FLASH_ERASE_SIZE &&
+	    (UPLOAD_HEADER_LENGTH + headerCodeSize(header)) % FLASH_ERASE_SIZE == 0)
+		return FLASH_ERASE_SIZE;
+	return 1;
+}
+
+// A FORMAT_PAGES file starts with the header, the page table and the signature, padded to
+// whole blocks, so that every page can be checked against the table as it arrives. The
+// header follows again with the code. The code is programmed at the start of the slot as
+// with FORMAT_IMAGE, and what came ahead of it right after it. Returns its length.
+static unsigned long headerTableLength(unsigned long code_size, unsigned int sign_size, unsigned long page_size)
+{
+	const unsigned long table_size = (UPLOAD_HEADER_LENGTH + code_size) / page_size * HASH_SIZE;
+	return (UPLOAD_HEADER_LENGTH + table_size + sign_size + TABLE_BLOCK_SIZE - 1) & ~(TABLE_BLOCK_SIZE - 1);
+}
+
+// Whether a page of the image at start hashes to its page table entry. The first page
+// starts with the header, which is not part of the hash.
+static char pageMatches(unsigned long start, unsigned long page, unsigned long page_size, const unsigned char *entry)
+{
+	unsigned char hash[HASH_SIZE];
+	const unsigned long from = page ? page * page_size : UPLOAD_HEADER_LENGTH;
+	SHA256_Simple((const unsigned char *)(start + from), (page + 1) * page_size - from, hash);
+	return memcmp(hash, entry, HASH_SIZE) == 0;
+}
+
+void cryptoHashBegin(unsigned long start, const unsigned char *header)
+{
+	const unsigned long code_size = headerCodeSize(header);
+	const unsigned long page_size = headerPageSize(header);
+
+	// Patches and anything unknown leave the hash to the check from flash
+	uploadHashState = HASH_INVALID;
+	uploadTableLength = 0;
+	if (header[0] != 'Z' || header[1] != '-' || page_size == 1 || code_size > SLOT_LENGTH - UPLOAD_HEADER_LENGTH)
+		return;
+	if (page_size) {
+		const unsigned long table_length = headerTableLength(code_size, header[6] + (header[7] << 8), page_size);
+		if (table_length > SLOT_LENGTH - UPLOAD_HEADER_LENGTH - code_size)
+			return;
+		uploadTableLength = table_length;
+	}
+	SHA256_Init(&uploadHash);
+	SHA256_Init(&uploadTableHash);
+	uploadHashStart = start;
+	uploadHashOffset = UPLOAD_HEADER_LENGTH;
+	uploadCodeEnd = UPLOAD_HEADER_LENGTH + code_size;
+	uploadTableOffset = uploadCodeEnd;
+	uploadPageSize = page_size;
+	uploadHashState = HASH_RUNNING;
+}
+
+unsigned long cryptoSlotOffset(unsigned long offset)
+{
+	if (offset < uploadTableLength)
+		return uploadCodeEnd + offset;
+	if (offset < uploadTableLength + uploadCodeEnd)
+		return offset - uploadTableLength;
+	return offset; // Past the end of the file, it stays past the end of the image
+}
+
+// The page table entry of a page with FORMAT_PAGES, NULL while it is not in flash yet
+static const unsigned char *uploadTableEntry(unsigned long page)
+{
+	const unsigned long entry = uploadCodeEnd + UPLOAD_HEADER_LENGTH + page * HASH_SIZE;
+	if (entry + HASH_SIZE > uploadTableOffset)
+		return NULL; // A patch assembles the image in slot order, the table comes last
+	return (const unsigned char *)(uploadHashStart + entry);
+}
+
+void cryptoHashUpdate(unsigned long start, unsigned long offset, const unsigned char *data, unsigned long length)
+{
+	if (uploadHashState == HASH_IDLE || uploadHashState == HASH_INVALID)
+		return;
+
+	if (start != uploadHashStart) {
+		uploadHashState = HASH_INVALID;
+		return;
+	}
+
+	if (offset >= uploadCodeEnd + uploadTableLength)
+		return; // The signature of FORMAT_IMAGE, or past the end of the image
+	if (offset >= uploadCodeEnd) {
+		// The page table and signature of FORMAT_PAGES. The pages are checked against the
+		// table, so it has to arrive in order as well
+		if (offset != uploadTableOffset)
+			uploadHashState = HASH_INVALID;
+		uploadTableOffset += length;
+		return;
+	}
+
+	// Any gap or rewrite means the running hash no longer matches the flash
+	if (uploadHashState == HASH_DONE || offset > uploadHashOffset || offset + length <= uploadHashOffset) {
+		uploadHashState = HASH_INVALID;
+		return;
+	}
+
+	unsigned long end = offset + length < uploadCodeEnd ? offset + length : uploadCodeEnd;
+	if (uploadHashState == HASH_BAD) {
+		// Only follow the blocks, one written again leaves the decision to the check from flash
+		uploadHashOffset = end;
+		return;
+	}
+	while (uploadHashOffset < end) {
+		unsigned long n = end - uploadHashOffset;
+		if (uploadPageSize) {
+			// Do not hash across a page boundary
+			unsigned long left = uploadPageSize - uploadHashOffset % uploadPageSize;
+			if (n > left)
+				n = left;
+		}
+		SHA256_Bytes(&uploadHash, data + (uploadHashOffset - offset), n);
+		uploadHashOffset += n;
+
+		if (uploadPageSize && uploadHashOffset % uploadPageSize == 0) {
+			// Page complete, append its hash to the table hash and check it against the table
+			const unsigned long page = uploadHashOffset / uploadPageSize - 1;
+			unsigned char pageDigest[HASH_SIZE];
+			SHA256_Final(&uploadHash, pageDigest);
+			SHA256_Bytes(&uploadTableHash, pageDigest, HASH_SIZE);
+			SHA256_Init(&uploadHash);
+			const unsigned char *entry = uploadTableEntry(page);
+			if (entry && memcmp(pageDigest, entry, HASH_SIZE) != 0) {
+#ifdef DEBUGPRINT
+				consolePrintf("Page %u does not match the page table\n", page);
+#endif
+				uploadHashState = HASH_BAD;
+				uploadHashOffset = end;
+				return;
+			}
+		}
+	}
+
+	if (uploadHashOffset == uploadCodeEnd) {
+		SHA256_Final(uploadPageSize ? &uploadTableHash : &uploadHash, uploadDigest);
+		uploadHashState = HASH_DONE;
+#ifdef DEBUGPRINT
+		consolePrintf("Code hashed during upload\n");
 #endif
+	}
+}
 
-char checkCryptoSignature()
+char cryptoPageInFlash(unsigned long offset)
 {
+	if (!uploadPageSize || uploadHashState != HASH_RUNNING || offset >= uploadCodeEnd)
+		return 0;
+	const unsigned long page = offset / uploadPageSize;
+	const unsigned char *entry = uploadTableEntry(page);
+	return entry && pageMatches(uploadHashStart, page, uploadPageSize, entry);
+}
+
+#ifdef ENCRYPT
+extern unsigned char AESKey[];
+extern const int AESKeyBits;
+
+static AES_State uploadCipher;
+static unsigned char uploadCounter[16];
+static unsigned long uploadCipherStart; // Offset of the first encrypted byte in the file
+static char uploadEncrypted;
 
-#ifdef DEBUGUART
-	UARTprintf("Checking digital signature ...\n\n");
+void cryptoDecrypt(unsigned long offset, unsigned char *data, unsigned long length)
+{
+	if (offset == 0) {
+		// The header is never encrypted, it tells whether the rest is. A patch keeps the
+		// installed image's size and hash where the others have the counter block, it
+		// follows the header there
+		const char delta = data[8] == FORMAT_DELTA;
+		const unsigned char cipher = delta ? data[9] : data[10];
+		uploadEncrypted = cipher != CIPHER_NONE;
+		if (!uploadEncrypted)
+			return;
+		int bits = cipher == CIPHER_AES_128_CTR ? 128 : cipher == CIPHER_AES_256_CTR ? 256 : 0;
+		if (bits != AESKeyBits || AES_Init(&uploadCipher, AESKey, bits) != 0) {
+#ifdef DEBUGPRINT
+			consolePrintf("Cipher does not match the key\n");
+#endif
+			uploadEncrypted = 0; // Leave the data as it is, the signature check will fail
+			return;
+		}
+		memcpy(uploadCounter, delta ? data + UPLOAD_HEADER_LENGTH : data + 12, sizeof(uploadCounter));
+		uploadCipherStart = delta ? UPLOAD_HEADER_LENGTH + DELTA_COUNTER_LENGTH : UPLOAD_HEADER_LENGTH;
+		data += uploadCipherStart;
+		length -= uploadCipherStart;
+		offset += uploadCipherStart;
+	}
+	if (uploadEncrypted)
+		AES_CTR(&uploadCipher, uploadCounter, offset - uploadCipherStart, data, length);
+}
 #endif
 
-	unsigned char *header = (unsigned char *)UPLOAD_START;
+// Check every page of the code against the (already authenticated) page table
+static char checkPageTable(unsigned long start, const unsigned char *table, unsigned long code_end, unsigned long page_size)
+{
+	for (unsigned long page = 0; page * page_size < code_end; page++) {
+		if (!pageMatches(start, page, page_size, table + page * HASH_SIZE)) {
+#ifdef DEBUGPRINT
+			consolePrintf("Page %u at 0x%x is corrupted\n\n", page, start + page * page_size);
+#endif
+			return 0;
+		}
+	}
+	return 1;
+}
+
+char checkCryptoSignature(unsigned long start)
+{
+
+#ifdef DEBUGPRINT
+	consolePrintf("Checking digital signature ...\n\n");
+#endif
+
+	unsigned char *header = (unsigned char *)start;
+	unsigned char *code = header + UPLOAD_HEADER_LENGTH;
 	if (header[0] != 'Z' || header[1] != '-') {
-#ifdef DEBUGUART
-	UARTprintf("Magic not found.\n\n");
+#ifdef DEBUGPRINT
+	consolePrintf("Magic not found.\n\n");
 #endif
 		return 0;
 	}
@@ -49,21 +299,64 @@ char checkCryptoSignature()
 	unsigned int sign_size = header[6] + (header[7] << 8);
 
 	if (sign_size != 512) {
-#ifdef DEBUGUART
-	UARTprintf("Signature does not have 512 bytes.\n\n");
+#ifdef DEBUGPRINT
+	consolePrintf("Signature does not have 512 bytes.\n\n");
+#endif
+		return 0;
+	}
+
+	unsigned long page_size = headerPageSize(header);
+	unsigned long trailer_size = page_size ? headerTableLength(code_size, sign_size, page_size) : sign_size;
+	if (page_size == 1 || code_size + trailer_size > SLOT_LENGTH - UPLOAD_HEADER_LENGTH) {
+#ifdef DEBUGPRINT
+	consolePrintf("Unknown format.\n\n");
 #endif
 		return 0;
 	}
 
-	int check = RSAVerifySignature((unsigned char *)UPLOAD_CODE_START, code_size, (unsigned char *)(UPLOAD_CODE_START + code_size), sign_size);
+	// The signature follows the code, with FORMAT_PAGES the copy of the header and the page table come first
+	unsigned int table_size = page_size ? (UPLOAD_HEADER_LENGTH + code_size) / page_size * HASH_SIZE : 0;
+	unsigned char *table = code + code_size + (page_size ? UPLOAD_HEADER_LENGTH : 0);
+	unsigned char *signature = table + table_size;
+
+	if (uploadHashState == HASH_BAD && uploadHashStart == start) {
+#ifdef DEBUGPRINT
+		consolePrintf("A page did not match the page table.\n\n");
+#endif
+		return 0;
+	}
+
+	int check;
+	if (uploadHashState == HASH_DONE && uploadHashStart == start && uploadCodeEnd == UPLOAD_HEADER_LENGTH + code_size && uploadPageSize == page_size) {
+		// The code was hashed while it was uploaded, only the RSA step is left
+		check = RSAVerifyDigest(uploadDigest, signature, sign_size);
+	} else if (page_size) {
+		// Authenticate the page table, then check the code against it so corruption can be located
+		check = RSAVerifySignature(table, table_size, signature, sign_size);
+		if (0 == check && !checkPageTable(start, table, UPLOAD_HEADER_LENGTH + code_size, page_size))
+			check = 9;
+	} else {
+		unsigned char hash[HASH_SIZE];
+#ifdef DEBUGPRINT
+		// Time the hash with the cycle counter, the RSA step takes the same time for any size
+		HWREG(DEMCR) |= DEMCR_TRCENA;
+		HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+		const uint32_t cycles = HWREG(DWT_CYCCNT);
+#endif
+		SHA256_Simple(code, code_size, hash);
+#ifdef DEBUGPRINT
+		consolePrintf("SHA-256 of %u bytes took %u cycles\n", code_size, HWREG(DWT_CYCCNT) - cycles);
+#endif
+		check = RSAVerifyDigest(hash, signature, sign_size);
+	}
 	if (0 == check) {
-#ifdef DEBUGUART
-		UARTprintf("Digital signature OK\n\n");
+#ifdef DEBUGPRINT
+		consolePrintf("Digital signature OK\n\n");
 #endif
 		return 1;
 	} else {
-#ifdef DEBUGUART
-		UARTprintf("Digital signature BAD (error %d)\n\n", check);
+#ifdef DEBUGPRINT
+		consolePrintf("Digital signature BAD (error %d)\n\n", check);
 #endif
 		return 0;
 	}
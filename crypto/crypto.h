@@ -25,6 +25,31 @@
 #ifndef __CRYPTO_H__
 #define __CRYPTO_H__
 
-char checkCryptoSignature();
+// Header format byte (offset 8), see signer/README
+#define FORMAT_IMAGE 0 // Signature over the whole code
+#define FORMAT_PAGES 1 // Signature over a table of the hashes of the flash pages, 2^header[9] bytes each
+#define FORMAT_DELTA 2 // Patch against the installed image, see delta.h
+
+// Header cipher byte (offset 10, formats 0 and 1), the counter block follows at offset 12.
+// A patch has the cipher at offset 9 and the counter block right after the header.
+#define CIPHER_NONE        0
+#define CIPHER_AES_128_CTR 1
+#define CIPHER_AES_256_CTR 2
+
+// Start hashing the image that is uploaded to start, from the header in its first block
+void cryptoHashBegin(unsigned long start, const unsigned char *header);
+// Where a block at offset in the uploaded file goes in the slot, a FORMAT_PAGES file has
+// its page table ahead of the code, see signer/README
+unsigned long cryptoSlotOffset(unsigned long offset);
+// Feed a block that was just programmed at start + offset into the running hash
+void cryptoHashUpdate(unsigned long start, unsigned long offset, const unsigned char *data, unsigned long length);
+#ifdef ENCRYPT
+// Decrypt a block that is about to be programmed at offset in the upload slot, in place
+void cryptoDecrypt(unsigned long offset, unsigned char *data, unsigned long length);
+#endif
+// Whether the page at offset in the upload slot holds what the page table of the upload says
+char cryptoPageInFlash(unsigned long offset);
+// Check the signature of the image programmed at start
+char checkCryptoSignature(unsigned long start);
 
 #endif
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "delta.h"
+#include "crypto.h"
+#include "sha256.h"
+#include "../common.h"
+#include "../bootctl.h"
+
+#include "inc/hw_flash.h"
+#include "inc/hw_types.h"
+#include "driverlib/flash.h"
+#include "driverlib/rom.h"
+
+#ifdef DEBUGPRINT
+#include "../console.h"
+#endif
+
+// The new image is assembled one flash page at a time in the upload slot. The installed
+// image in the other slot is left alone, so any byte of it can be copied, and it still
+// boots if the patch turns out broken. Without DUALSLOT the patch would have to overwrite
+// the installed image before the signature of the result is checked, so it is refused.
+#define PAGE_SIZE FLASH_ERASE_SIZE
+#define PAGE_START(offset) ((offset) & ~(PAGE_SIZE - 1))
+
+enum {
+	DELTA_IDLE,
+	DELTA_OP,    // Waiting for the next op byte
+	DELTA_ARGS,  // Collecting the arguments of the current op
+	DELTA_DATA,  // Copying literal bytes
+	DELTA_DONE,
+	DELTA_ERROR,
+};
+
+static uint8_t pageBuffer[PAGE_SIZE] __attribute__ ((aligned(4)));
+static unsigned long deltaOffset;  // Next offset expected in the delta file
+static unsigned long outOffset;    // Bytes of the new image produced so far
+static unsigned long targetLength; // Length of the new image
+static unsigned long baseLength;   // Length of the installed image the patch applies to
+static unsigned long dataLeft;     // Literal bytes left in the current DATA op
+static unsigned long baseStart;    // Where the installed image is
+static unsigned long targetStart;  // Where the new image is programmed
+static uint8_t op, args[6];
+static unsigned int argsUsed, argsLength;
+static char deltaState = DELTA_IDLE;
+
+static void deltaError(const char *reason)
+{
+#ifdef DEBUGPRINT
+	consolePrintf("Delta: %s\n", reason);
+#endif
+	deltaState = DELTA_ERROR;
+}
+
+// Program the page that is being assembled, the unused end of a last page is left erased
+static void flushPage()
+{
+	unsigned long start = PAGE_START(outOffset - 1);
+	unsigned long used = outOffset - start;
+
+	for (unsigned long i = used; i < PAGE_SIZE; i++)
+		pageBuffer[i] = 0xFF;
+	if (start == 0)
+		cryptoHashBegin(targetStart, pageBuffer); // The header of the new image
+	ROM_FlashErase(targetStart + start);
+	if (ROM_FlashProgram((uint32_t *)pageBuffer, targetStart + start, (used + 3) & ~3) == 0)
+		cryptoHashUpdate(targetStart, start, pageBuffer, used);
+}
+
+static void emit(const uint8_t *src, unsigned long length)
+{
+	while (length) {
+		unsigned long n = PAGE_SIZE - (outOffset & (PAGE_SIZE - 1));
+		if (n > length)
+			n = length;
+		memcpy(pageBuffer + (outOffset & (PAGE_SIZE - 1)), src, n);
+		outOffset += n;
+		src += n;
+		length -= n;
+		if ((outOffset & (PAGE_SIZE - 1)) == 0)
+			flushPage();
+	}
+}
+
+static void copyFromBase(unsigned long source, unsigned long length)
+{
+	if (source > baseLength || length > baseLength - source) {
+		deltaError("copy source outside the installed image");
+		return;
+	}
+	emit((const uint8_t *)(baseStart + source), length);
+}
+
+static char startDelta(const unsigned char *header)
+{
+#ifndef DUALSLOT
+	// Patching in place would overwrite the installed image while it is still being copied from
+	deltaError("patches need DUALSLOT");
+	return 0;
+#else
+	unsigned char hash[32];
+
+	targetLength = header[2] + (header[3] << 8) + (header[4] << 16) + (header[5] << 24);
+	baseLength = header[10] + (header[11] << 8) + (header[12] << 16) + (header[13] << 24);
+	if (targetLength > SLOT_LENGTH || baseLength > SLOT_LENGTH) {
+		deltaError("bad header");
+		return 0;
+	}
+
+	// Refuse to patch anything but the image the delta was made against. The header only
+	// has room for half of the hash, the result is checked against its signature anyway.
+	baseStart = activeSlot();
+	targetStart = uploadSlot();
+	SHA256_Simple((unsigned char *)baseStart, baseLength, hash);
+	if (memcmp(hash, header + 14, 16) != 0) {
+		deltaError("installed image does not match");
+		return 0;
+	}
+
+	outOffset = 0;
+	deltaState = DELTA_OP;
+	return 1;
+#endif
+}
+
+void deltaWrite(unsigned long offset, const unsigned char *data, unsigned long length)
+{
+	if (offset == 0) {
+		// An encrypted patch has the counter block after the header, the ops follow it
+		const unsigned long opsStart = UPLOAD_HEADER_LENGTH + (data[9] != CIPHER_NONE ? DELTA_COUNTER_LENGTH : 0);
+		if (length < opsStart || !startDelta(data))
+			return;
+		data += opsStart;
+		length -= opsStart;
+		offset += opsStart;
+		deltaOffset = opsStart;
+	}
+	if (deltaState == DELTA_IDLE || deltaState == DELTA_DONE || deltaState == DELTA_ERROR)
+		return;
+	if (offset != deltaOffset) {
+		// The patch is a stream, a missing block cannot be recovered
+		deltaError("out of order block");
+		return;
+	}
+	deltaOffset += length;
+
+	while (length && deltaState != DELTA_DONE && deltaState != DELTA_ERROR) {
+		switch (deltaState) {
+			case DELTA_OP:
+				op = *data++;
+				length--;
+				argsUsed = 0;
+				if (op == DELTA_OP_END) {
+					if (outOffset & (PAGE_SIZE - 1))
+						flushPage();
+					if (outOffset != targetLength) {
+						deltaError("wrong image length");
+						break;
+					}
+					deltaState = DELTA_DONE;
+#ifdef DEBUGPRINT
+					consolePrintf("Delta applied\n");
+#endif
+				} else if (op == DELTA_OP_COPY) {
+					argsLength = 6;
+					deltaState = DELTA_ARGS;
+				} else if (op == DELTA_OP_DATA) {
+					argsLength = 2;
+					deltaState = DELTA_ARGS;
+				} else {
+					deltaError("unknown op");
+				}
+				break;
+			case DELTA_ARGS:
+				args[argsUsed++] = *data++;
+				length--;
+				if (argsUsed < argsLength)
+					break;
+				if (op == DELTA_OP_COPY) {
+					unsigned long source = args[0] + (args[1] << 8) + (args[2] << 16) + ((unsigned long)args[3] << 24);
+					unsigned long n = args[4] + (args[5] << 8);
+					if (outOffset + n > targetLength) {
+						deltaError("image too long");
+						break;
+					}
+					deltaState = DELTA_OP;
+					copyFromBase(source, n);
+				} else {
+					dataLeft = args[0] + (args[1] << 8);
+					if (outOffset + dataLeft > targetLength) {
+						deltaError("image too long");
+						break;
+					}
+					deltaState = dataLeft ? DELTA_DATA : DELTA_OP;
+				}
+				break;
+			case DELTA_DATA: {
+				unsigned long n = dataLeft < length ? dataLeft : length;
+				emit(data, n);
+				data += n;
+				length -= n;
+				dataLeft -= n;
+				if (dataLeft == 0)
+					deltaState = DELTA_OP;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+}
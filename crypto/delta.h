@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+// Delta ops, see signer/README
+#define DELTA_OP_END  0x00 // End of the patch
+#define DELTA_OP_COPY 0x01 // u32 source offset, u16 length: copy from the installed image
+#define DELTA_OP_DATA 0x02 // u16 length, followed by the bytes
+
+// Length of the counter block between the header and the ops of an encrypted patch
+#define DELTA_COUNTER_LENGTH 16
+
+// Feed a block of the delta file, at the given offset in the file, to the patcher
+void deltaWrite(unsigned long offset, const unsigned char *data, unsigned long length);
+
+#endif
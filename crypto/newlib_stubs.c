@@ -21,6 +21,10 @@
 #include <sys/unistd.h>
 #include "driverlib/uart.h"
 
+#ifdef STACKCHECK
+#include "../stackcheck.h"
+#endif
+
 #ifndef STDOUT_USART
 #define STDOUT_USART 1
 #endif
@@ -136,6 +140,10 @@ int _lseek(int file, int ptr, int dir) {
  Increase program data space.
  Malloc and related functions depend on this
  */
+#ifdef STACKCHECK
+uint32_t heapPeak; // Bytes, the heap never shrinks so this is also its current size
+#endif
+
 caddr_t _sbrk(int incr) {
   extern char _end; // Defined in linkerscript, end of .data and .bss
 
@@ -156,6 +164,10 @@ caddr_t _sbrk(int incr) {
   }
 
   heap_end += incr;
+#ifdef STACKCHECK
+  if ((uint32_t)(heap_end - &_end) > heapPeak)
+    heapPeak = heap_end - &_end;
+#endif
   return (void*) prev_heap_end;
 
 }
@@ -34,8 +34,15 @@ static const unsigned char asn1_stuff[20] = {
 
 int RSAVerifySignature(unsigned char *data, int datalen, unsigned char *sig, int siglen)
 {
-    mpz_t in, out, modulus;
     unsigned char hash[32];
+
+    SHA256_Simple(data, datalen, hash);
+    return RSAVerifyDigest(hash, sig, siglen);
+}
+
+int RSAVerifyDigest(const unsigned char *hash, unsigned char *sig, int siglen)
+{
+    mpz_t in, out, modulus;
     unsigned char result[512];
     int i, reslen;
 
@@ -88,7 +95,6 @@ int RSAVerifySignature(unsigned char *data, int datalen, unsigned char *sig, int
         }
     }
 
-    SHA256_Simple(data, datalen, hash);
     for (i = 0; i < 32; i++) {
         if (result[i + 479] != hash[i]) {
             return 9;
@@ -2,5 +2,6 @@
 #define __RSA_H__
 
 int RSAVerifySignature(unsigned char *data, int datalen, unsigned char *sig, int siglen);
+int RSAVerifyDigest(const unsigned char *hash, unsigned char *sig, int siglen);
 
 #endif
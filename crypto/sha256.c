@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "sha256.h"
 
 /*
@@ -19,6 +21,22 @@
 #define smallsigma0(x) ( ror((x),7) ^ ror((x),18) ^ shr((x),3) )
 #define smallsigma1(x) ( ror((x),17) ^ ror((x),19) ^ shr((x),10) )
 
+/*
+ * Load a big-endian word from message bytes. The memcpy keeps the
+ * load legal under strict aliasing whatever the buffer was declared
+ * as; on the Cortex-M4, which allows unaligned word loads, GCC turns
+ * it into a single LDR and the builtin into a single REV.
+ */
+static inline unsigned int load_be(const unsigned char *p) {
+    unsigned int x;
+    memcpy(&x, p, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return x;
+#else
+    return __builtin_bswap32(x);
+#endif
+}
+
 void SHA256_Core_Init(SHA256_State *s) {
     s->h[0] = 0x6a09e667;
     s->h[1] = 0xbb67ae85;
@@ -30,8 +48,15 @@ void SHA256_Core_Init(SHA256_State *s) {
     s->h[7] = 0x5be0cd19;
 }
 
-void SHA256_Block(SHA256_State *s, unsigned int *block) {
-    unsigned int w[80];
+/*
+ * Process one 64-byte block. 'block' points at the message bytes
+ * themselves, at any alignment; the words are byte swapped as they
+ * are loaded. Only a 16-word window of the message schedule
+ * is kept, w[t & 15] being overwritten by w[t] once w[t - 16] has
+ * been consumed.
+ */
+static void SHA256_Block(SHA256_State *s, const unsigned char *block) {
+    unsigned int w[16];
     unsigned int a,b,c,d,e,f,g,h;
     static const int k[] = {
         0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
@@ -55,32 +80,49 @@ void SHA256_Block(SHA256_State *s, unsigned int *block) {
     int t;
 
     for (t = 0; t < 16; t++)
-        w[t] = block[t];
-
-    for (t = 16; t < 64; t++)
-        w[t] = smallsigma1(w[t-2]) + w[t-7] + smallsigma0(w[t-15]) + w[t-16];
+        w[t] = load_be(block + 4 * t);
 
     a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
     e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
 
-    for (t = 0; t < 64; t+=8) {
-        unsigned int t1, t2;
-
-#define ROUND(j,a,b,c,d,e,f,g,h) \
-        t1 = h + bigsigma1(e) + Ch(e,f,g) + k[j] + w[j]; \
+#define W(j) w[(j) & 15]
+#define SCHEDULE(j) \
+        ( W(j) += smallsigma1(W((j)-2)) + W((j)-7) + smallsigma0(W((j)-15)) )
+#define ROUND(j,wj,a,b,c,d,e,f,g,h) \
+        t1 = h + bigsigma1(e) + Ch(e,f,g) + k[j] + (wj); \
         t2 = bigsigma0(a) + Maj(a,b,c); \
         d = d + t1; h = t1 + t2;
 
-        ROUND(t+0, a,b,c,d,e,f,g,h);
-        ROUND(t+1, h,a,b,c,d,e,f,g);
-        ROUND(t+2, g,h,a,b,c,d,e,f);
-        ROUND(t+3, f,g,h,a,b,c,d,e);
-        ROUND(t+4, e,f,g,h,a,b,c,d);
-        ROUND(t+5, d,e,f,g,h,a,b,c);
-        ROUND(t+6, c,d,e,f,g,h,a,b);
-        ROUND(t+7, b,c,d,e,f,g,h,a);
+    for (t = 0; t < 16; t+=8) {
+        unsigned int t1, t2;
+
+        ROUND(t+0, W(t+0), a,b,c,d,e,f,g,h);
+        ROUND(t+1, W(t+1), h,a,b,c,d,e,f,g);
+        ROUND(t+2, W(t+2), g,h,a,b,c,d,e,f);
+        ROUND(t+3, W(t+3), f,g,h,a,b,c,d,e);
+        ROUND(t+4, W(t+4), e,f,g,h,a,b,c,d);
+        ROUND(t+5, W(t+5), d,e,f,g,h,a,b,c);
+        ROUND(t+6, W(t+6), c,d,e,f,g,h,a,b);
+        ROUND(t+7, W(t+7), b,c,d,e,f,g,h,a);
+    }
+
+    for (t = 16; t < 64; t+=8) {
+        unsigned int t1, t2;
+
+        ROUND(t+0, SCHEDULE(t+0), a,b,c,d,e,f,g,h);
+        ROUND(t+1, SCHEDULE(t+1), h,a,b,c,d,e,f,g);
+        ROUND(t+2, SCHEDULE(t+2), g,h,a,b,c,d,e,f);
+        ROUND(t+3, SCHEDULE(t+3), f,g,h,a,b,c,d,e);
+        ROUND(t+4, SCHEDULE(t+4), e,f,g,h,a,b,c,d);
+        ROUND(t+5, SCHEDULE(t+5), d,e,f,g,h,a,b,c);
+        ROUND(t+6, SCHEDULE(t+6), c,d,e,f,g,h,a,b);
+        ROUND(t+7, SCHEDULE(t+7), b,c,d,e,f,g,h,a);
     }
 
+#undef ROUND
+#undef SCHEDULE
+#undef W
+
     s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
     s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
 }
@@ -100,8 +142,7 @@ void SHA256_Init(SHA256_State *s) {
 }
 
 void SHA256_Bytes(SHA256_State *s, const void *p, int len) {
-    unsigned char *q = (unsigned char *)p;
-    unsigned int wordblock[16];
+    const unsigned char *q = (const unsigned char *)p;
     unsigned int lenw = len;
     int i;
 
@@ -115,34 +156,30 @@ void SHA256_Bytes(SHA256_State *s, const void *p, int len) {
         /*
          * Trivial case: just add to the block.
          */
-        for (i = 0; i < len; i++) {
-            s->block[s->blkused + i] = q[i];
-        }
+        memcpy(s->block + s->blkused, q, len);
         s->blkused += len;
     } else {
         /*
          * We must complete and process at least one block.
          */
-        while (s->blkused + len >= BLKSIZE) {
-            for (i = 0; i < BLKSIZE - s->blkused; i++) {
-                s->block[s->blkused + i] = q[i];
-            }
-            q += BLKSIZE - s->blkused;
-            len -= BLKSIZE - s->blkused;
-            /* Now process the block. Gather bytes big-endian into words */
-            for (i = 0; i < 16; i++) {
-                wordblock[i] =
-                    ( ((unsigned int)s->block[i*4+0]) << 24 ) |
-                    ( ((unsigned int)s->block[i*4+1]) << 16 ) |
-                    ( ((unsigned int)s->block[i*4+2]) <<  8 ) |
-                    ( ((unsigned int)s->block[i*4+3]) <<  0 );
-            }
-            SHA256_Block(s, wordblock);
+        if (s->blkused) {
+            i = BLKSIZE - s->blkused;
+            memcpy(s->block + s->blkused, q, i);
+            q += i;
+            len -= i;
+            SHA256_Block(s, s->block);
             s->blkused = 0;
         }
-        for (i = 0; i < len; i++) {
-            s->block[i] = q[i];
+        /*
+         * Whole blocks of the input (e.g. flash or a USB buffer)
+         * are hashed in place without copying them.
+         */
+        while (len >= BLKSIZE) {
+            SHA256_Block(s, q);
+            q += BLKSIZE;
+            len -= BLKSIZE;
         }
+        memcpy(s->block, q, len);
         s->blkused = len;
     }
 }
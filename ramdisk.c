@@ -27,24 +27,46 @@
 
 #include "ramdisk.h"
 #include "boot_usb_msc.h"
+#include "bootctl.h"
 #include "common.h"
+#include "sched.h"
 
 #include "inc/hw_flash.h"
 #include "inc/hw_memmap.h"
 #include "inc/hw_sysctl.h"
 #include "inc/hw_types.h"
 #include "driverlib/flash.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/rom.h"
+#include "driverlib/udma.h"
+#include "driverlib/usb.h"
 #include "usblib/usblib.h"
 #include "usblib/device/usbdevice.h"
 
-#ifdef DEBUGUART
-#include "utils/uartstdio.h"
+#ifdef DEBUGPRINT
+#include "console.h"
+#endif
+
+#ifdef CRYPTO
+#include "crypto/crypto.h"
+#include "crypto/delta.h"
+#endif
+
+#ifdef CRC32
+#include "crc32.h"
+#endif
+
+#ifdef VERIFY
+#include "verify.h"
+#endif
+
+#ifdef STACKCHECK
+#include "stackcheck.h"
 #endif
 
 #define WBVAL(x) ((x) & 0xFF), (((x) >> 8) & 0xFF)
 #define QBVAL(x) ((x) & 0xFF), (((x) >> 8) & 0xFF), (((x) >> 16) & 0xFF), (((x) >> 24) & 0xFF)
 
-#define BLOCK_SIZE 512
 #define BYTES_PER_SECTOR 512
 #define SECTORS_PER_CLUSTER 4
 #define RESERVED_SECTORS 1
@@ -54,10 +76,58 @@
 #define FIRMWARE_BIN_CLUSTER 3
 #define DATA_REGION_SECTOR (RESERVED_SECTORS + FAT_COPIES + (ROOT_ENTRIES * ROOT_ENTRY_LENGTH) / BYTES_PER_SECTOR)
 #define FIRMWARE_START_SECTOR (DATA_REGION_SECTOR + (firmware_start_cluster - 2) * SECTORS_PER_CLUSTER)
+#define CLUSTER_COUNT ((1024 - DATA_REGION_SECTOR) / SECTORS_PER_CLUSTER)
+#define VERIFY_CLUSTER (CLUSTER_COUNT + 1) // The last one (an even one), hosts put new files at the front
+#define VERIFY_SECTOR (DATA_REGION_SECTOR + (VERIFY_CLUSTER - 2) * SECTORS_PER_CLUSTER)
+#define WRITE_QUEUE_LENGTH 4 // Blocks waiting to be programmed, a power of two
+#define METADATA_CACHE_LENGTH 4 // Blocks the host wrote outside the firmware file
+#define NOT_IN_FILE 0xFFFFFFFF
 
 int massStorageDrive = 0;
 bool newFirmwareStartSet = false;
+unsigned long uploadStart = UPLOAD_START;
+#ifdef CRC32
+bool uploadVerified = false;
+#endif
+#ifdef CRYPTO
+static bool deltaUpload = false; // The file being uploaded is a patch against the installed image
+#endif
 unsigned long firmware_start_cluster = FIRMWARE_BIN_CLUSTER;
+UploadStats uploadStats;
+
+// Erasing and programming take far too long for the USB interrupt, which only copies the
+// firmware blocks into this queue. The main loop programs them, a block per task, so the
+// other tasks get their turn in between.
+static struct {
+	unsigned long offset; // From uploadStart
+	uint32_t queued;      // schedTicks() when the block arrived
+	unsigned char data[BLOCK_SIZE] __attribute__ ((aligned(4)));
+} writeQueue[WRITE_QUEUE_LENGTH];
+static volatile unsigned int writeHead, writeTail; // Free running, the difference is the queue depth
+// Pages of the upload slot that the upload in progress has written to, a bit each. The
+// first block that goes into a page erases it, unless it is blank already.
+static uint32_t uploadPages[(SLOT_LENGTH / FLASH_ERASE_SIZE + 31) / 32];
+
+// Mass storage is on endpoint 1. usblib moves its OUT packets into a block buffer by uDMA
+// and then hands the block to massStorageWrite, and a block that is not taken fails the
+// whole SCSI WRITE. So while the write queue is full, the requests of the endpoint's uDMA
+// channel and its interrupt are masked: the next packet waits in the endpoint FIFO and the
+// controller NAKs the host, while EP0 and the other interfaces carry on.
+#define MSC_OUT_DMA_CHANNEL (UDMA_CHANNEL_USBEP1RX)
+#define MSC_OUT_INT         (USB_INTEP_DEV_OUT_1)
+static bool massStorageHeld;
+
+// Hosts write their own files and directories (.fseventsd, System Volume Information,
+// ._firmware.bin...) into the data region next to the firmware. Only the clusters of the
+// firmware file, as far as the host's FAT and directory writes tell, are programmed. The
+// rest goes to this cache, so the host can read back what it just wrote, or is dropped.
+static struct {
+	unsigned long blockNumber; // 0 if unused
+	unsigned char data[BLOCK_SIZE];
+} metadataCache[METADATA_CACHE_LENGTH];
+static unsigned int metadataCacheNext;
+static unsigned long firmwareFileSize = SLOT_LENGTH; // From the directory entry, once the host has written it
+static unsigned long lastCluster, lastClusterIndex; // Where the last lookup in the chain ended
 
 unsigned char bootSector[] = {
 	0xeb, 0x3c, 0x90,                                      // Code to jump to the bootstrap code
@@ -151,6 +221,10 @@ unsigned char fatTable[] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+#ifdef VERIFY
+    // VERIFY.TXT takes one cluster, the end of its chain
+    [VERIFY_CLUSTER * 3 / 2] = 0xFF, [VERIFY_CLUSTER * 3 / 2 + 1] = 0x0F,
+#endif
 };
 
 #define FIRMWARE_DATE_TIME (((2017 - 1980) << 25) /* Year since 1980 */ | \
@@ -202,28 +276,363 @@ unsigned char dirEntry[] = {
 	0x00, 0x00,                             // Reserved for FAT32
 	QBVAL(FIRMWARE_DATE_TIME),              // Creation date and time
 	WBVAL(FIRMWARE_BIN_CLUSTER),            // Starting cluster
-	QBVAL(UPLOAD_LENGTH)                    // File size in bytes
+	QBVAL(SLOT_LENGTH),                     // File size in bytes
+#ifdef VERIFY
+	// 8.3 entry of the query file, see verify.h
+	'V', 'E', 'R', 'I', 'F', 'Y', ' ', ' ', // Filename
+	'T', 'X', 'T',                          // Extension
+	ATTR_ARCHIVE,                           // Attribute byte
+	0x00,                                   // Reserved for Windows NT
+	0x00,                                   // Creation millisecond
+	QBVAL(FIRMWARE_DATE_TIME),              // Creation date and time
+	WBVAL(FIRMWARE_DATE_TIME >> 16),        // Last access date
+	0x00, 0x00,                             // Reserved for FAT32
+	QBVAL(FIRMWARE_DATE_TIME),              // Creation date and time
+	WBVAL(VERIFY_CLUSTER),                  // Starting cluster
+	QBVAL(BYTES_PER_SECTOR),                // File size in bytes
+#endif
 };
 
+// Whether a range of flash is erased. Reading it takes far less than erasing it again, and
+// unlike a flag it cannot go stale when an upload is abandoned halfway.
+static bool flashBlank(unsigned long address, unsigned long length)
+{
+	const uint32_t *words = (const uint32_t *)address;
+	for (int i = 0; i < length / 4; i++) {
+		if (words[i] != 0xFFFFFFFF)
+			return false;
+	}
+	return true;
+}
+
+// Whether a block is in flash already
+static bool flashHolds(unsigned long address, const unsigned char *data)
+{
+	const unsigned char *bytes = (const unsigned char *)address;
+	for (int i = 0; i < BLOCK_SIZE; i++) {
+		if (bytes[i] != data[i])
+			return false;
+	}
+	return true;
+}
+
+// Programs a block into its page, which has been erased for this upload unless the page
+// table found it unchanged. Flash bits only go from 1 to 0, so a block the host writes
+// again (Linux flushes a partly filled last block early and writes it once more when the
+// rest has arrived), or one that differs in a page that was kept, takes erasing the page
+// and programming it again, with the rest of the page as it was.
+static int32_t programPage(unsigned long page, unsigned long address, unsigned char *data)
+{
+	static uint32_t buffer[FLASH_ERASE_SIZE / 4];
+
+	if (flashBlank(address, BLOCK_SIZE))
+		return ROM_FlashProgram((uint32_t *)data, address, BLOCK_SIZE);
+	if (flashHolds(address, data))
+		return 0; // E.g. in a page that was not erased because it is unchanged
+
+	const uint32_t *words = (const uint32_t *)page;
+	for (int i = 0; i < FLASH_ERASE_SIZE / 4; i++)
+		buffer[i] = words[i];
+	for (int i = 0; i < BLOCK_SIZE; i++)
+		((unsigned char *)buffer)[address - page + i] = data[i];
+	ROM_FlashErase(page);
+	return ROM_FlashProgram(buffer, page, FLASH_ERASE_SIZE);
+}
+
+// Runs from the main loop, offset is the position of the block in the new firmware
+static void programBlock(unsigned long offset, unsigned char *data)
+{
+#ifdef ENCRYPT
+	// Before anything looks at the block, patches are encrypted as well
+	cryptoDecrypt(offset, data, BLOCK_SIZE);
+#endif
+#ifdef CRYPTO
+	if (offset == 0)
+		cryptoHashBegin(uploadStart, data);
+	if (deltaUpload) {
+		// The patcher erases and programs page by page itself
+		deltaWrite(offset, data, BLOCK_SIZE);
+		return;
+	}
+	// A file with a page table has it ahead of the code, it is programmed after the code
+	offset = cryptoSlotOffset(offset);
+#endif
+	const unsigned long address = uploadStart + offset;
+	// Erase a page when the first block for it arrives, a page at a time keeps every task short
+	const unsigned long index = offset / FLASH_ERASE_SIZE;
+	const unsigned long page = uploadStart + index * FLASH_ERASE_SIZE;
+	if (!(uploadPages[index / 32] & 1UL << index % 32)) {
+		uploadPages[index / 32] |= 1UL << index % 32;
+#ifdef CRYPTO
+		// A page that holds what the page table says already is left as it is, so are its blocks
+		if (!flashBlank(page, FLASH_ERASE_SIZE) && !cryptoPageInFlash(offset))
+#else
+		if (!flashBlank(page, FLASH_ERASE_SIZE))
+#endif
+			ROM_FlashErase(page);
+	}
+#ifdef DEBUGPRINT
+	consolePrintf("Writing to flash at: %u\n", address);
+#endif
+#ifdef CRYPTO
+	// Hash the code while it is being uploaded, a failed program leaves a gap and the hash is discarded
+	if (programPage(page, address, data) == 0)
+		cryptoHashUpdate(uploadStart, offset, data, BLOCK_SIZE);
+#else
+	programPage(page, address, data);
+#endif
+#ifdef CRC32
+	// Check the image as soon as its last block is in
+	const unsigned long codeStart = uploadStart + UPLOAD_CODE_OFFSET;
+	const uint32_t *stamp = (const uint32_t *)(codeStart + IMAGE_CRC_OFFSET);
+	if (stamp[0] == IMAGE_CRC_MAGIC && address < codeStart + stamp[1] && address + BLOCK_SIZE >= codeStart + stamp[1])
+		uploadVerified = checkImageCrc(codeStart, SLOT_LENGTH - UPLOAD_CODE_OFFSET);
+#endif
+}
+
+// Programs the oldest queued block, returns false if the queue is empty now
+static bool programQueuedBlock(void)
+{
+	if (writeHead == writeTail)
+		return false;
+
+	unsigned int head = writeHead;
+	programBlock(writeQueue[head % WRITE_QUEUE_LENGTH].offset, writeQueue[head % WRITE_QUEUE_LENGTH].data);
+
+	const uint32_t latency = schedTicks() - writeQueue[head % WRITE_QUEUE_LENGTH].queued;
+	if (latency > uploadStats.queueMaxLatency)
+		uploadStats.queueMaxLatency = latency;
+	uploadStats.blocksProgrammed++;
+	uploadStats.lastBlockTicks = schedTicks();
+
+	// Free the block and let the host go on, without the interrupt filling the queue in between
+	const bool masked = ROM_IntMasterDisable();
+	writeHead = head + 1;
+	if (massStorageHeld) {
+		massStorageHeld = false;
+		USBIntEnableEndpoint(USB0_BASE, MSC_OUT_INT);
+		ROM_uDMAChannelAttributeDisable(MSC_OUT_DMA_CHANNEL, UDMA_ATTR_REQMASK);
+	}
+	const bool more = writeHead != writeTail;
+	if (!masked)
+		ROM_IntMasterEnable();
+	return more;
+}
+
+static void drainWriteQueue(void)
+{
+	if (programQueuedBlock())
+		schedPost(drainWriteQueue);
+}
+
+bool uploadBusy(void)
+{
+	return writeTail - writeHead == WRITE_QUEUE_LENGTH;
+}
+
+// Called from the USB interrupt, returns false if the queue is full or the scheduler's is
+bool uploadBlock(unsigned long offset, const unsigned char *data)
+{
+	const unsigned int tail = writeTail;
+	if (tail - writeHead == WRITE_QUEUE_LENGTH)
+		return false;
+	// A block queued without the task that drains it would never be programmed. Nothing runs
+	// the task before this interrupt returns, so it can be posted ahead of the block.
+	if (!schedPost(drainWriteQueue))
+		return false;
+
+	writeQueue[tail % WRITE_QUEUE_LENGTH].offset = offset;
+	writeQueue[tail % WRITE_QUEUE_LENGTH].queued = schedTicks();
+	for (int i = 0; i < BLOCK_SIZE; i++)
+		writeQueue[tail % WRITE_QUEUE_LENGTH].data[i] = data[i];
+	writeTail = tail + 1;
+
+	if (tail + 1 - writeHead > uploadStats.queueMaxDepth)
+		uploadStats.queueMaxDepth = tail + 1 - writeHead;
+	// Back-pressure: mass storage is NAKed until drainWriteQueue frees a block
+	if (tail + 1 - writeHead == WRITE_QUEUE_LENGTH) {
+		massStorageHeld = true;
+		ROM_uDMAChannelAttributeEnable(MSC_OUT_DMA_CHANNEL, UDMA_ATTR_REQMASK);
+		USBIntDisableEndpoint(USB0_BASE, MSC_OUT_INT);
+	}
+	return true;
+}
+
+// FAT12 entry of a cluster in the host's latest FAT
+static unsigned int fatEntry(unsigned long cluster)
+{
+	const unsigned char *entry = fatTable + cluster * 3 / 2;
+	return cluster & 1 ? (entry[0] >> 4 | entry[1] << 4) : (entry[0] | (entry[1] & 0x0F) << 8);
+}
+
+// The cluster after the given one in the firmware file, 0 at its end. Hosts often write the
+// data before the FAT, an unallocated cluster then continues with the next free one, which
+// is where a host's allocator puts it.
+static unsigned long nextCluster(unsigned long cluster)
+{
+	const unsigned int entry = fatEntry(cluster);
+	if (entry >= 2 && entry < CLUSTER_COUNT + 2)
+		return entry;
+	if (entry != 0)
+		return 0; // End of chain or bad cluster
+	for (unsigned long next = cluster + 1; next < CLUSTER_COUNT + 2; next++) {
+		if (fatEntry(next) == 0)
+			return next;
+	}
+	return 0;
+}
+
+// Offset of a data region block in the firmware file being uploaded, or NOT_IN_FILE
+static unsigned long fileOffset(unsigned long blockNumber)
+{
+	const unsigned long cluster = (blockNumber - DATA_REGION_SECTOR) / SECTORS_PER_CLUSTER + 2;
+	const unsigned long clusterBytes = SECTORS_PER_CLUSTER * BLOCK_SIZE;
+	if (!newFirmwareStartSet)
+		return NOT_IN_FILE;
+
+	// Hosts write in file order, so start where the last lookup ended and only walk the
+	// chain from the beginning if the cluster is not further along
+	for (int pass = 0; pass < 2; pass++) {
+		unsigned long current = pass == 0 ? lastCluster : firmware_start_cluster;
+		unsigned long index = pass == 0 ? lastClusterIndex : 0;
+		while (current && index * clusterBytes < firmwareFileSize) {
+			if (current == cluster) {
+				lastCluster = current;
+				lastClusterIndex = index;
+				const unsigned long offset = index * clusterBytes + (blockNumber - DATA_REGION_SECTOR) % SECTORS_PER_CLUSTER * BLOCK_SIZE;
+				return offset < firmwareFileSize ? offset : NOT_IN_FILE;
+			}
+			current = nextCluster(current);
+			index++;
+		}
+	}
+	return NOT_IN_FILE;
+}
+
+// Takes the size of the firmware file from a directory block, so that whatever the host
+// puts in the clusters behind it stays out of flash
+static void scanDirectory(const unsigned char *data)
+{
+	for (int i = 0; i < BLOCK_SIZE; i += ROOT_ENTRY_LENGTH) {
+		const unsigned char *entry = data + i;
+		if (entry[0] == 0x00 || entry[0] == 0xE5 || (entry[11] & (ATTR_DIRECTORY | ATTR_VOLUME_ID)))
+			continue; // Free, deleted, a long name, a directory or the volume label
+		const unsigned long size = entry[28] | entry[29] << 8 | entry[30] << 16 | (unsigned long)entry[31] << 24;
+		if (newFirmwareStartSet && (entry[26] | entry[27] << 8) == firmware_start_cluster && size != 0 && size <= SLOT_LENGTH)
+			firmwareFileSize = (size + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+	}
+}
+
+static unsigned char *cachedBlock(unsigned long blockNumber)
+{
+	for (int i = 0; i < METADATA_CACHE_LENGTH; i++) {
+		if (metadataCache[i].blockNumber == blockNumber)
+			return metadataCache[i].data;
+	}
+	return 0;
+}
+
+static void cacheBlock(unsigned long blockNumber, const unsigned char *data)
+{
+	unsigned char *cached = cachedBlock(blockNumber);
+	if (!cached) {
+		metadataCache[metadataCacheNext].blockNumber = blockNumber;
+		cached = metadataCache[metadataCacheNext].data;
+		metadataCacheNext = (metadataCacheNext + 1) % METADATA_CACHE_LENGTH;
+	}
+	for (int i = 0; i < BLOCK_SIZE; i++)
+		cached[i] = data[i];
+	uploadStats.metadataBlocks++;
+}
+
 void *massStorageOpen(unsigned long drive)
 {
 	return ((void *)&massStorageDrive);
 }
 
+static void finishUpload(void)
+{
+	uploadFlush();
+#ifdef DEBUGPRINT
+	consolePrintf("Write queue: max depth %u, max latency %u ms\n", uploadStats.queueMaxDepth, uploadStats.queueMaxLatency * 1000 / SCHED_TICK_HZ);
+	consolePrintf("Metadata blocks kept out of flash: %u\n", uploadStats.metadataBlocks);
+#ifdef STACKCHECK
+	consolePrintf("Stack: %u of %u bytes used\n", stackHighWater(), stackSize());
+#ifdef CRYPTO
+	consolePrintf("Heap: %u bytes at most\n", heapPeak);
+#endif
+#endif
+#endif
+	USBDCDTerm(0); // Terminate the USB connection
+	CallUserProgram();
+}
+
 void massStorageClose(void *drive)
 {
-#ifdef DEBUGUART
-    UARTprintf("massStorageClose\n");
+#ifdef DEBUGPRINT
+    consolePrintf("massStorageClose\n");
+#endif
+    uploadEnd();
+}
+
+void uploadBegin(const unsigned char *firstBlock)
+{
+	newFirmwareStartSet = true;
+	uploadStart = uploadSlot();
+	uploadStats.firstBlockTicks = schedTicks();
+	for (int i = 0; i < sizeof(uploadPages) / sizeof(uploadPages[0]); i++)
+		uploadPages[i] = 0;
+#ifdef CRYPTO
+	deltaUpload = firstBlock[8] == FORMAT_DELTA;
+#endif
+#ifdef DEBUGPRINT
+	consolePrintf("New firmware start\n");
+#endif
+}
+
+void uploadErase(unsigned long offset, unsigned long length)
+{
+	uploadStart = uploadSlot();
+	for (unsigned long page = offset & ~(FLASH_ERASE_SIZE - 1); page < offset + length; page += FLASH_ERASE_SIZE)
+		ROM_FlashErase(uploadStart + page);
+}
+
+void uploadFlush(void)
+{
+	while (programQueuedBlock())
+		;
+}
+
+void uploadEnd(void)
+{
+	// Program the blocks that are still queued before starting the new firmware
+	schedPost(finishUpload);
+}
+
+#ifndef NOREAD
+// A block of the upload, from the write queue while it is waiting there
+static void readUploadBlock(unsigned long offset, unsigned char *data)
+{
+#ifdef CRYPTO
+	const unsigned char *block = (const unsigned char *)(uploadStart + cryptoSlotOffset(offset));
+#else
+	const unsigned char *block = (const unsigned char *)(uploadStart + offset);
 #endif
-    USBDCDTerm(0); // Terminate the USB connection
-    CallUserProgram();
+	for (unsigned int i = writeHead; i != writeTail; i++) {
+		if (writeQueue[i % WRITE_QUEUE_LENGTH].offset == offset)
+			block = writeQueue[i % WRITE_QUEUE_LENGTH].data;
+	}
+	for (int i = 0; i < BLOCK_SIZE; i++)
+		data[i] = block[i];
 }
+#endif
 
 unsigned long massStorageRead(void *drive, unsigned char *data, unsigned long blockNumber, unsigned long numberOfBlocks)
 {
-#if defined(DEBUGUART) && 0
-	UARTprintf("Reading %d block(s) starting at %d\n", numberOfBlocks, blockNumber);
+#if defined(DEBUGPRINT) && 0
+	consolePrintf("Reading %d block(s) starting at %d\n", numberOfBlocks, blockNumber);
 #endif
+	uploadStats.blocksRead += numberOfBlocks;
 	for (int i = 0; i < BLOCK_SIZE; i++) {
 		data[i] = 0;
 	}
@@ -245,7 +654,29 @@ unsigned long massStorageRead(void *drive, unsigned char *data, unsigned long bl
 			data[i] = dirEntry[i];
 		}
 	}
-	else if (blockNumber >= FIRMWARE_START_SECTOR && blockNumber < FIRMWARE_START_SECTOR + UPLOAD_LENGTH / BLOCK_SIZE) {
+#ifdef VERIFY
+	else if (blockNumber == VERIFY_SECTOR) {
+		verifyRead(data);
+	}
+#endif
+	else if (cachedBlock(blockNumber)) {
+		const unsigned char *cached = cachedBlock(blockNumber);
+		for (int i = 0; i < BLOCK_SIZE; i++) {
+			data[i] = cached[i];
+		}
+	}
+	else if (blockNumber >= DATA_REGION_SECTOR && fileOffset(blockNumber) != NOT_IN_FILE) {
+		// The new image as far as the host has written it, so that it can verify it
+#ifdef NOREAD
+		unsigned char dummy[16] = "READ DISABLED  \n";
+		for (int i = 0; i < BLOCK_SIZE; i++) {
+			data[i] = dummy[i % 16];
+		}
+#else
+		readUploadBlock(fileOffset(blockNumber), data);
+#endif
+	}
+	else if (blockNumber >= FIRMWARE_START_SECTOR && blockNumber < FIRMWARE_START_SECTOR + SLOT_LENGTH / BLOCK_SIZE) {
 #ifdef NOREAD
 		unsigned char dummy[16] = "READ DISABLED  \n";
 		for (int i = 0; i < BLOCK_SIZE; i++) {
@@ -253,7 +684,7 @@ unsigned long massStorageRead(void *drive, unsigned char *data, unsigned long bl
 		}
 #else
 		for (int i = 0; i < BLOCK_SIZE; i++) {
-			data[i] = ((unsigned char *)(UPLOAD_START + (blockNumber - FIRMWARE_START_SECTOR) * BLOCK_SIZE))[i];
+			data[i] = ((unsigned char *)(activeSlot() + (blockNumber - FIRMWARE_START_SECTOR) * BLOCK_SIZE))[i];
 		}
 #endif
 	}
@@ -262,31 +693,45 @@ unsigned long massStorageRead(void *drive, unsigned char *data, unsigned long bl
 
 // Inspired by: https://github.com/opentx/opentx/blob/eb7c73668f55026c57b880027acc77f1bd2ee00a/radio/src/targets/taranis/flash_driver.cpp
 // Please report back if this header does not match your binary file
-static bool isFirmwareStart(const uint8_t *buffer) {
+bool isFirmwareStart(const uint8_t *buffer) {
+#ifdef CRYPTO
+    // Signed firmware starts with the "Z-" header and the vector table follows it
+    if (buffer[0] != 'Z' || buffer[1] != '-')
+        return false;
+    if (buffer[8] == FORMAT_DELTA)
+        return true; // A patch, it has no vector table
+    if (buffer[8] == FORMAT_PAGES)
+        return true; // The page table comes first, the vector table later
+    if (buffer[10] != CIPHER_NONE)
+        return true; // The vector table is encrypted
+    buffer += UPLOAD_HEADER_LENGTH;
+#endif
+    // Stack pointer in SRAM, reset and fault handlers in the 256 kB of flash
     const uint32_t *block = (const uint32_t*)buffer;
     if ((block[0] & 0xFFFC0000) != 0x20000000)
         return false;
-    if ((block[1] & 0xFFFF000F) != 0x9)
+    if ((block[1] & 0xFFFC000F) != 0x9)
         return false;
-    if ((block[2] & 0xFFFF000F) != 0x1)
+    if ((block[2] & 0xFFFC000F) != 0x1)
         return false;
-    if ((block[3] & 0xFFFF000F) != 0x3)
+    if ((block[3] & 0xFFFC000F) != 0x3)
         return false;
     return true;
 }
 
 unsigned long massStorageWrite(void *drive, unsigned char *data, unsigned long blockNumber, unsigned long numberOfBlocks)
 {
-#if defined(DEBUGUART) && 0
-	UARTprintf("Writing %d block(s) starting at %d\n", numberOfBlocks, blockNumber);
-	UARTprintf("Firmware start cluster: %d\n", firmware_start_cluster);
+#if defined(DEBUGPRINT) && 0
+	consolePrintf("Writing %d block(s) starting at %d\n", numberOfBlocks, blockNumber);
+	consolePrintf("Firmware start cluster: %d\n", firmware_start_cluster);
 	for (int j = 0; j < BLOCK_SIZE * numberOfBlocks; j += 16) {
 		for (int i = 0; i < 16; i++) {
-			UARTprintf("%02x ",data[j+i]);
+			consolePrintf("%02x ",data[j+i]);
 		}
-		UARTprintf("\n");
+		consolePrintf("\n");
 	}
 #endif
+	uploadStats.blocksWritten += numberOfBlocks;
 	if (blockNumber == 0) {
 		for (int i = 0; i < sizeof(bootSector); i++) {
 			bootSector[i] = data[i];
@@ -298,34 +743,39 @@ unsigned long massStorageWrite(void *drive, unsigned char *data, unsigned long b
 		}
 	}
 	else if (blockNumber == 3) {
+		scanDirectory(data);
 		for (int i = 0; i < sizeof(dirEntry); i++) {
 			dirEntry[i] = data[i];
 		}
 	}
-	// The bootloader is 16 kB i.e. 32 blocks of 512 bytes
-	else if (blockNumber >= FIRMWARE_START_SECTOR) {
-		if (isFirmwareStart(data)) { // TODO: Reset flag after when the firmware has been read
-			// the host tried to write actual data to the data region, we assume this is the new firmware
-			newFirmwareStartSet = true;
-			firmware_start_cluster = (blockNumber - DATA_REGION_SECTOR) / SECTORS_PER_CLUSTER + 2;
-#ifdef DEBUGUART
-            UARTprintf("New firmware start\n");
-#endif
-		}
-		// New firmware is being uploaded
-		if (newFirmwareStartSet && blockNumber < FIRMWARE_START_SECTOR + UPLOAD_LENGTH / BLOCK_SIZE) {
-			unsigned long address = (blockNumber - FIRMWARE_START_SECTOR) * BLOCK_SIZE + UPLOAD_START;
-			// Erase
-			if (blockNumber == FIRMWARE_START_SECTOR) {
-				for (int counter = 0; counter < UPLOAD_LENGTH / FLASH_ERASE_SIZE; counter++) {
-					FlashErase(UPLOAD_START + counter * FLASH_ERASE_SIZE);
-				}
+	else if (blockNumber < DATA_REGION_SECTOR) {
+		scanDirectory(data);
+		cacheBlock(blockNumber, data);
+	}
+	else {
+		for (unsigned long i = 0; i < numberOfBlocks; i++) {
+			unsigned char *block = data + i * BLOCK_SIZE;
+#ifdef VERIFY
+			if (blockNumber + i == VERIFY_SECTOR) {
+				verifyWrite(block);
+				continue;
 			}
-#ifdef DEBUGUART
-            UARTprintf("Writing to flash at: %u\n", blockNumber);
 #endif
-			FlashProgram((unsigned long *)data, address, BLOCK_SIZE * numberOfBlocks);
-			return BLOCK_SIZE * numberOfBlocks;
+			unsigned long offset = fileOffset(blockNumber + i);
+			// A block that looks like the start of an image at the start of a cluster that is
+			// not part of the file yet, we assume this is the new firmware
+			if (offset == NOT_IN_FILE && (blockNumber + i - DATA_REGION_SECTOR) % SECTORS_PER_CLUSTER == 0 && isFirmwareStart(block)) {
+				uploadBegin(block);
+				firmware_start_cluster = (blockNumber + i - DATA_REGION_SECTOR) / SECTORS_PER_CLUSTER + 2;
+				firmwareFileSize = SLOT_LENGTH;
+				lastCluster = firmware_start_cluster;
+				lastClusterIndex = 0;
+				offset = 0;
+			}
+			if (offset == NOT_IN_FILE)
+				cacheBlock(blockNumber + i, block);
+			else if (!uploadBlock(offset, block))
+				return i * BLOCK_SIZE;
 		}
 	}
 	return BLOCK_SIZE * numberOfBlocks;
@@ -31,6 +31,40 @@ extern unsigned long massStorageRead(void *drive, unsigned char *data, unsigned
 extern unsigned long massStorageWrite(void *drive, unsigned char *data, unsigned long blockNumber, unsigned long numberOfBlocks);
 extern unsigned long massStorageNumBlocks(void *drive);
 
+// The flash side of an upload, shared by the mass storage callbacks and the interfaces
+// that bypass the filesystem. The new image goes to uploadSlot(): uploadBegin takes its
+// first block, uploadBlock queues each block of BLOCK_SIZE bytes at its offset in the
+// image (from the USB interrupt, false while the queue is full or the block cannot be
+// scheduled) and uploadEnd programs what is left and starts the image. Each page is
+// erased when its first block arrives. From the main loop, uploadErase erases part of the slot ahead of time and uploadFlush programs
+// what is queued. While uploadBusy, the interfaces other than mass storage must hold the host
+// back themselves.
+#define BLOCK_SIZE 512
+extern bool isFirmwareStart(const uint8_t *buffer);
+extern void uploadBegin(const unsigned char *firstBlock);
+extern bool uploadBusy(void);
+extern bool uploadBlock(unsigned long offset, const unsigned char *data);
+extern void uploadEnd(void);
+extern void uploadErase(unsigned long offset, unsigned long length);
+extern void uploadFlush(void);
+
 extern bool newFirmwareStartSet;
+extern unsigned long uploadStart; // Where the firmware being uploaded is programmed
+#ifdef CRC32
+extern bool uploadVerified; // The uploaded image is complete and its CRC32 matches
+#endif
+
+// Counters of the session since the bootloader started, printed by the console
+typedef struct {
+	uint32_t blocksRead;
+	uint32_t blocksWritten;    // By the host, including its metadata
+	uint32_t metadataBlocks;   // Written blocks kept out of flash
+	uint32_t blocksProgrammed;
+	uint32_t queueMaxDepth;    // Of the write queue
+	uint32_t queueMaxLatency;  // Ticks from arrival until programmed
+	uint32_t firstBlockTicks;  // schedTicks() when the new image started
+	uint32_t lastBlockTicks;   // and when its last block so far was programmed
+} UploadStats;
+extern UploadStats uploadStats;
 
 #endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sched.h"
+
+#include "driverlib/rom.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/systick.h"
+#include "driverlib/sysctl.h"
+
+// Tasks run to completion in the main loop, so they never preempt each other. Interrupt
+// handlers only queue them, which keeps the time spent with interrupts blocked short.
+static volatile SchedTask queue[SCHED_QUEUE_LENGTH];
+static volatile unsigned int queueHead, queueTail; // Free running, the difference is the queue depth
+
+static struct {
+	SchedTask task;
+	uint32_t period;    // Ticks
+	uint32_t remaining;
+} timers[SCHED_TIMERS];
+static int timerCount;
+
+static volatile uint32_t ticks;
+
+bool schedPost(SchedTask task)
+{
+	bool posted = true;
+	const bool masked = ROM_IntMasterDisable();
+
+	unsigned int i = queueHead;
+	while (i != queueTail && queue[i % SCHED_QUEUE_LENGTH] != task)
+		i++;
+	if (i == queueTail) {
+		if (queueTail - queueHead < SCHED_QUEUE_LENGTH)
+			queue[queueTail++ % SCHED_QUEUE_LENGTH] = task;
+		else
+			posted = false;
+	}
+
+	if (!masked)
+		ROM_IntMasterEnable();
+	return posted;
+}
+
+void schedEvery(SchedTask task, uint32_t period)
+{
+	if (timerCount == SCHED_TIMERS)
+		return;
+	timers[timerCount].task = task;
+	timers[timerCount].period = (period * SCHED_TICK_HZ + 999) / 1000;
+	timers[timerCount].remaining = timers[timerCount].period;
+	timerCount++;
+}
+
+uint32_t schedTicks(void)
+{
+	return ticks;
+}
+
+void SysTickIntHandler(void)
+{
+	ticks++;
+	for (int i = 0; i < timerCount; i++) {
+		if (--timers[i].remaining == 0) {
+			timers[i].remaining = timers[i].period;
+			schedPost(timers[i].task);
+		}
+	}
+}
+
+void schedRun(void)
+{
+	ROM_SysTickPeriodSet(ROM_SysCtlClockGet() / SCHED_TICK_HZ);
+	ROM_SysTickIntEnable();
+	ROM_SysTickEnable();
+
+	while (1) {
+		SchedTask task = 0;
+
+		// Check the queue and go to sleep with interrupts masked, so an interrupt that
+		// queues a task in between still wakes us up. It is taken once they are unmasked.
+		ROM_IntMasterDisable();
+		if (queueHead != queueTail)
+			task = queue[queueHead++ % SCHED_QUEUE_LENGTH];
+		else
+			__asm("    wfi\n");
+		ROM_IntMasterEnable();
+
+		if (task)
+			task();
+	}
+}
+
+void schedStop(void)
+{
+	ROM_SysTickIntDisable();
+	ROM_SysTickDisable();
+}
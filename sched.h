@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_TICK_HZ      (100) // SysTick rate, timers have a resolution of 10 ms
+#define SCHED_QUEUE_LENGTH (8)   // Tasks waiting to run, must be a power of two
+#define SCHED_TIMERS       (2)
+
+typedef void (*SchedTask)(void);
+
+// Queues task to run from the main loop, also from interrupt handlers. A task that is
+// already waiting is not queued twice. Returns false if the queue is full.
+bool schedPost(SchedTask task);
+// Posts task every period milliseconds, call before schedRun
+void schedEvery(SchedTask task, uint32_t period);
+// Ticks since schedRun, for measuring latencies
+uint32_t schedTicks(void);
+// Runs the queued tasks one after the other and sleeps while there are none, never returns
+void schedRun(void);
+// Stops the tick before another program takes over the vector table
+void schedStop(void);
+void SysTickIntHandler(void);
+
+#endif
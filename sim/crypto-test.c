@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Known answer tests and throughput of the crypto primitives, on the host.
+// Usage: crypto-test [megabytes]
+// The digests are the examples of FIPS 180-2, hashed in one piece and in odd sized
+// unaligned pieces so that both paths of SHA256_Bytes are covered. The ciphertexts are the
+// CTR examples of NIST SP 800-38A for AES-128 and AES-256, in one piece and block by block
+// at their offsets in the stream, as cryptoDecrypt uses AES_CTR. The throughput is the
+// host's, it tells whether a change to a core made it faster or slower, not how fast the
+// Cortex-M4 is. Exits with 0 if every answer matches.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crypto/aes.h"
+#include "crypto/sha256.h"
+
+static bool ok = true;
+
+static void check(const char *name, const unsigned char *result, const char *expected)
+{
+	char hex[129];
+	for (size_t i = 0; i < strlen(expected) / 2; i++)
+		sprintf(hex + 2 * i, "%02x", result[i]);
+	const bool matches = strcmp(hex, expected) == 0;
+	printf("%-36s %s\n", name, matches ? "ok" : "FAILED");
+	if (!matches)
+		printf("    got      %s\n    expected %s\n", hex, expected);
+	ok &= matches;
+}
+
+static double seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void testSha256(void)
+{
+	static const struct {
+		const char *message;
+		const char *digest;
+	} vectors[] = {
+		{ "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		{ "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	};
+	static const char *million = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+	unsigned char digest[32];
+	SHA256_State state;
+
+	for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		char name[40];
+		snprintf(name, sizeof(name), "SHA-256 \"%.20s%s\"", vectors[i].message, strlen(vectors[i].message) > 20 ? "..." : "");
+		SHA256_Simple(vectors[i].message, strlen(vectors[i].message), digest);
+		check(name, digest, vectors[i].digest);
+	}
+
+	// One million times 'a', aligned in one piece and then unaligned in pieces of 1 to 97 bytes
+	static unsigned char a[1000001] __attribute__ ((aligned(4)));
+	memset(a, 'a', sizeof(a));
+	SHA256_Simple(a, 1000000, digest);
+	check("SHA-256 a x 1000000", digest, million);
+	SHA256_Init(&state);
+	for (int done = 0, n = 1; done < 1000000; done += n, n = n % 97 + 1) {
+		if (n > 1000000 - done)
+			n = 1000000 - done;
+		SHA256_Bytes(&state, a + 1 + done % 3, n);
+	}
+	SHA256_Final(&state, digest);
+	check("SHA-256 a x 1000000 in pieces", digest, million);
+}
+
+static void fromHex(const char *hex, unsigned char *bytes)
+{
+	for (size_t i = 0; i < strlen(hex) / 2; i++)
+		sscanf(hex + 2 * i, "%2hhx", &bytes[i]);
+}
+
+static void testAesCtr(void)
+{
+	static const struct {
+		const char *name;
+		const char *key;
+		const char *ciphertext;
+	} vectors[] = {
+		{ "AES-128-CTR", "2b7e151628aed2a6abf7158809cf4f3c",
+		  "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+		  "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee" },
+		{ "AES-256-CTR", "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+		  "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+		  "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6" },
+	};
+	static const char *counter = "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+	static const char *plaintext = "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+	                               "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+	unsigned char key[32], iv[16], data[64];
+	AES_State state;
+
+	fromHex(counter, iv);
+	for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		char name[40];
+		const int bits = strlen(vectors[i].key) * 4;
+		fromHex(vectors[i].key, key);
+		AES_Init(&state, key, bits);
+
+		fromHex(plaintext, data);
+		AES_CTR(&state, iv, 0, data, sizeof(data));
+		check(vectors[i].name, data, vectors[i].ciphertext);
+
+		// The counter carries into its upper bytes from the second block on
+		fromHex(plaintext, data);
+		for (int offset = 0; offset < sizeof(data); offset += 16)
+			AES_CTR(&state, iv, offset, data + offset, 16);
+		snprintf(name, sizeof(name), "%s by block", vectors[i].name);
+		check(name, data, vectors[i].ciphertext);
+	}
+}
+
+static void benchAesCtr(int megabytes)
+{
+	// Blocks as the bootloader decrypts them, with a 256 bit key, the slower one
+	static unsigned char buffer[512];
+	unsigned char key[32] = { 0 }, iv[16] = { 0 };
+	AES_State state;
+
+	AES_Init(&state, key, 256);
+	const double started = seconds();
+	for (unsigned long offset = 0; offset < (unsigned long)megabytes << 20; offset += sizeof(buffer))
+		AES_CTR(&state, iv, offset, buffer, sizeof(buffer));
+	const double elapsed = seconds() - started;
+	printf("AES-256-CTR %d MB in %.3f s, %.1f MB/s\n", megabytes, elapsed, megabytes / elapsed);
+}
+
+static void benchSha256(int megabytes)
+{
+	static unsigned char buffer[1 << 20] __attribute__ ((aligned(4)));
+	unsigned char digest[32];
+	SHA256_State state;
+
+	memset(buffer, 0x5A, sizeof(buffer));
+	SHA256_Init(&state);
+	const double started = seconds();
+	for (int i = 0; i < megabytes; i++)
+		SHA256_Bytes(&state, buffer, sizeof(buffer));
+	SHA256_Final(&state, digest);
+	const double elapsed = seconds() - started;
+	printf("SHA-256 %d MB in %.3f s, %.1f MB/s\n", megabytes, elapsed, megabytes / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+	const int megabytes = argc > 1 ? atoi(argv[1]) : 64;
+
+	testSha256();
+	testAesCtr();
+	if (megabytes > 0) {
+		benchSha256(megabytes);
+		benchAesCtr(megabytes);
+	}
+	return ok ? 0 : 2;
+}
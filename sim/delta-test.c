@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Applies patches (see crypto/signer/README) with crypto/delta.c to the simulated flash,
+// block by block as an upload feeds them, and checks the new image in the upload slot.
+// Broken patches must leave the installed image alone. Always built with DUALSLOT, the
+// only configuration that takes patches. Exits with 0 if every case passes.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "common.h"
+#include "bootctl.h"
+#include "crypto/crypto.h"
+#include "crypto/delta.h"
+#include "crypto/sha256.h"
+
+#define BASE_LENGTH (30000)
+
+static unsigned char base[BASE_LENGTH];
+static unsigned char patch[SLOT_LENGTH];
+static unsigned long patchLength;
+static unsigned char target[SLOT_LENGTH];
+static unsigned long targetLength;
+static bool ok = true;
+
+// The running hash of the upload is checked by the upload tests, not here
+void cryptoHashBegin(unsigned long start, const unsigned char *header)
+{
+}
+
+void cryptoHashUpdate(unsigned long start, unsigned long offset, const unsigned char *data, unsigned long length)
+{
+}
+
+void simAdvance(uint32_t duration)
+{
+}
+
+static void check(const char *name, bool passed)
+{
+	printf("%-38s %s\n", name, passed ? "ok" : "FAILED");
+	ok &= passed;
+}
+
+static void put16(unsigned long value)
+{
+	patch[patchLength++] = value;
+	patch[patchLength++] = value >> 8;
+}
+
+static void put32(unsigned long value)
+{
+	put16(value);
+	put16(value >> 16);
+}
+
+// The ops append to the patch and apply themselves to the expected image
+static void startPatch(void)
+{
+	patchLength = UPLOAD_HEADER_LENGTH;
+	targetLength = 0;
+}
+
+static void opCopy(unsigned long source, unsigned int length)
+{
+	patch[patchLength++] = DELTA_OP_COPY;
+	put32(source);
+	put16(length);
+	if (source + length <= BASE_LENGTH)
+		memcpy(target + targetLength, base + source, length);
+	targetLength += length;
+}
+
+static void opData(unsigned int length)
+{
+	patch[patchLength++] = DELTA_OP_DATA;
+	put16(length);
+	for (unsigned int i = 0; i < length; i++)
+		target[targetLength + i] = patch[patchLength + i] = rand();
+	patchLength += length;
+	targetLength += length;
+}
+
+static void endPatch(void)
+{
+	unsigned char hash[32];
+
+	patch[patchLength++] = DELTA_OP_END;
+	const unsigned long end = patchLength;
+	patchLength = 0;
+	patch[patchLength++] = 'Z';
+	patch[patchLength++] = '-';
+	put32(targetLength);
+	put16(0);            // No signature of its own
+	patch[patchLength++] = FORMAT_DELTA;
+	patch[patchLength++] = CIPHER_NONE;
+	put32(BASE_LENGTH);
+	SHA256_Simple(base, BASE_LENGTH, hash);
+	memcpy(patch + patchLength, hash, 16);
+	patchLength = end;
+}
+
+// Installs base in the active slot and erases the upload slot, as before an upload
+static void install(void)
+{
+	memset(simFlash(activeSlot()), 0xFF, SLOT_LENGTH);
+	memcpy(simFlash(activeSlot()), base, BASE_LENGTH);
+	memset(simFlash(uploadSlot()), 0xFF, SLOT_LENGTH);
+}
+
+// Feeds the patch in 512 byte blocks, the last one padded with zeros
+static void feed(unsigned long from, unsigned long to)
+{
+	for (unsigned long offset = from; offset < to; offset += SIM_BLOCK_SIZE) {
+		unsigned char block[SIM_BLOCK_SIZE] __attribute__ ((aligned(4))) = { 0 };
+		const unsigned long n = patchLength - offset < SIM_BLOCK_SIZE ? patchLength - offset : SIM_BLOCK_SIZE;
+		memcpy(block, patch + offset, n);
+		deltaWrite(offset, block, SIM_BLOCK_SIZE);
+	}
+}
+
+static bool baseIntact(void)
+{
+	return memcmp(simFlash(activeSlot()), base, BASE_LENGTH) == 0;
+}
+
+static bool targetProgrammed(void)
+{
+	return memcmp(simFlash(uploadSlot()), target, targetLength) == 0;
+}
+
+static bool uploadSlotBlank(void)
+{
+	for (unsigned long i = 0; i < SLOT_LENGTH; i++) {
+		if (simFlash(uploadSlot())[i] != 0xFF)
+			return false;
+	}
+	return true;
+}
+
+// Unchanged, new, moved and repeated code, across page boundaries in both directions
+static void typicalPatch(void)
+{
+	startPatch();
+	opCopy(0, 4000);
+	opData(300);
+	opCopy(20000, 5000);
+	opCopy(1000, 3000);
+	opData(1500);
+	opCopy(BASE_LENGTH - 1000, 1000);
+	endPatch();
+}
+
+int main(int argc, char **argv)
+{
+	simFlashInit();
+	srand(1);
+	for (int i = 0; i < BASE_LENGTH; i++)
+		base[i] = rand();
+
+	install();
+	typicalPatch();
+	feed(0, patchLength);
+	check("Patch applied", targetProgrammed() && baseIntact());
+	check("Unused end of the last page erased", simFlash(uploadSlot())[targetLength] == 0xFF);
+
+	install();
+	typicalPatch();
+	patch[14] ^= 1; // First byte of the installed image's hash
+	feed(0, patchLength);
+	check("Other installed image refused", uploadSlotBlank() && baseIntact());
+
+	install();
+	typicalPatch();
+	feed(0, SIM_BLOCK_SIZE * 2);
+	check("Truncated patch", !targetProgrammed() && baseIntact());
+
+	install();
+	typicalPatch();
+	feed(0, SIM_BLOCK_SIZE);
+	feed(SIM_BLOCK_SIZE * 2, patchLength);
+	check("Block missing", !targetProgrammed() && baseIntact());
+
+	install();
+	startPatch();
+	opCopy(0, 2000);
+	opCopy(BASE_LENGTH - 10, 100);
+	endPatch();
+	feed(0, patchLength);
+	check("Copy from outside the installed image", !targetProgrammed() && baseIntact());
+
+	return ok ? 0 : 2;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+
+// Downloads a firmware file through the DFU interface like "dfu-util -D" and reports
+// what it cost, for comparison with msc-sim.
+// Usage: dfu-sim [-e erase us] [-p program us] [-c control transfer us] firmware.bin
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "common.h"
+#include "ramdisk.h"
+#include "usblib/device/usbdcomp.h"
+#include "usb_dfu.h"
+
+#define DFU_DNLOAD    1
+#define DFU_GETSTATUS 3
+
+#define DFU_STATE_DNBUSY      4
+#define DFU_STATE_DNLOAD_IDLE 5
+#define DFU_STATE_MANIFEST    7
+#define DFU_STATE_ERROR       10
+
+static tCompositeEntry dfu;
+
+static bool dfuRequest(uint8_t request, uint16_t value, unsigned char *data, uint16_t length)
+{
+	tUSBRequest setup = {
+		.bmRequestType = USB_RTYPE_CLASS | USB_RTYPE_INTERFACE | (request == DFU_GETSTATUS ? USB_RTYPE_DIR_IN : 0),
+		.bRequest = request,
+		.wValue = value,
+		.wLength = length,
+	};
+	return simControl(dfu.psDevInfo, dfu.pvInstance, &setup, data) >= 0;
+}
+
+// DFU_GETSTATUS until the device leaves dfuDNBUSY, waiting as long as it asks for
+static int dfuStatus(unsigned long *polls)
+{
+	unsigned char status[6];
+	do {
+		if (!dfuRequest(DFU_GETSTATUS, 0, status, sizeof(status)))
+			return -1;
+		(*polls)++;
+		simIdle((status[1] | status[2] << 8 | status[3] << 16) * 1000);
+	} while (status[4] == DFU_STATE_DNBUSY);
+	return status[0] != 0 ? DFU_STATE_ERROR : status[4];
+}
+
+int main(int argc, char **argv)
+{
+	int option;
+	while ((option = getopt(argc, argv, "e:p:c:")) != -1) {
+		switch (option) {
+		case 'e': simTiming.erase = atoi(optarg); break;
+		case 'p': simTiming.program = atoi(optarg); break;
+		case 'c': simTiming.control = atoi(optarg); break;
+		default: optind = argc; break;
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, "Usage: dfu-sim [-e erase us] [-p program us] [-c control transfer us] firmware.bin\n");
+		return 1;
+	}
+
+	static unsigned char image[FLASH_SIZE];
+	FILE *f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	const size_t length = fread(image, 1, sizeof(image), f);
+	fclose(f);
+
+	simFlashInit();
+	dfuCompositeInit(&dfu);
+
+	// As dfu-util: each block is followed by DFU_GETSTATUS, a zero length DFU_DNLOAD
+	// ends the download and the device detaches in the manifestation phase
+	unsigned long polls = 0;
+	int state = DFU_STATE_DNLOAD_IDLE;
+	for (size_t offset = 0; offset < length && state == DFU_STATE_DNLOAD_IDLE; offset += DFU_TRANSFER_SIZE) {
+		const uint16_t size = length - offset < DFU_TRANSFER_SIZE ? length - offset : DFU_TRANSFER_SIZE;
+		if (!dfuRequest(DFU_DNLOAD, offset / DFU_TRANSFER_SIZE, image + offset, size))
+			state = DFU_STATE_ERROR;
+		else
+			state = dfuStatus(&polls);
+	}
+	if (state == DFU_STATE_DNLOAD_IDLE && dfuRequest(DFU_DNLOAD, 0, NULL, 0))
+		state = dfuStatus(&polls);
+	// dfu-util waits another second in dfuMANIFEST before asking again, not counted here
+	if (state == DFU_STATE_MANIFEST)
+		state = dfuStatus(&polls);
+	simFinish();
+
+	printf("%s: %zu bytes in %zu DFU_DNLOAD requests, %lu DFU_GETSTATUS, final state %d\n",
+	       argv[optind], length, (length + DFU_TRANSFER_SIZE - 1) / DFU_TRANSFER_SIZE, polls, state);
+	return simReport(image, length, 0) ? 0 : 2;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "sim.h"
+#include "common.h"
+
+#include "inc/hw_flash.h"
+#include "driverlib/flash.h"
+
+SimTiming simTiming = {
+	.erase = 12000,
+	.program = 30,
+	.usbBlock = 600,
+	.control = 1000,
+};
+SimStats simStats;
+
+void simFlashInit(void)
+{
+	void *flash = mmap((void *)FLASH_BASE, FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (flash != (void *)FLASH_BASE) {
+		fprintf(stderr, "Can not map the simulated flash at 0x%lx\n", (unsigned long)FLASH_BASE);
+		exit(1);
+	}
+	memset(flash, 0xFF, FLASH_SIZE);
+}
+
+unsigned char *simFlash(unsigned long address)
+{
+	return (unsigned char *)address;
+}
+
+static bool inFlash(uint32_t address, uint32_t count)
+{
+	return address >= FLASH_BASE && address - FLASH_BASE + count <= FLASH_SIZE;
+}
+
+int32_t FlashErase(uint32_t address)
+{
+	if ((address & (FLASH_ERASE_SIZE - 1)) || !inFlash(address, FLASH_ERASE_SIZE))
+		return -1;
+	memset(simFlash(address), 0xFF, FLASH_ERASE_SIZE);
+	simStats.erases++;
+	simStats.flashTime += simTiming.erase;
+	simAdvance(simTiming.erase);
+	return 0;
+}
+
+int32_t FlashProgram(uint32_t *data, uint32_t address, uint32_t count)
+{
+	if ((address & 3) || (count & 3) || !inFlash(address, count))
+		return -1;
+	// Programming can only clear bits
+	uint32_t *flash = (uint32_t *)simFlash(address);
+	for (uint32_t i = 0; i < count / 4; i++) {
+		if (data[i] & ~flash[i])
+			simStats.programErrors++;
+		flash[i] &= data[i];
+	}
+	simStats.programs++;
+	simStats.programmedBytes += count;
+	simStats.flashTime += (uint64_t)simTiming.program * (count / 4);
+	simAdvance(simTiming.program * (count / 4));
+	return 0;
+}
@@ -0,0 +1,12 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_FLASH_H__
+#define __SIM_FLASH_H__
+
+#include <stdint.h>
+
+// Operate on the in-memory flash of sim/flash.c
+int32_t FlashErase(uint32_t address);
+int32_t FlashProgram(uint32_t *data, uint32_t address, uint32_t count);
+
+#endif
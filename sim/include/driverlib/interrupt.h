@@ -0,0 +1,7 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_INTERRUPT_H__
+#define __SIM_INTERRUPT_H__
+
+
+#endif
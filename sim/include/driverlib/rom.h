@@ -0,0 +1,17 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_ROM_H__
+#define __SIM_ROM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The simulation is single threaded, interrupts are never masked
+#define ROM_IntMasterDisable()  false
+#define ROM_IntMasterEnable()   ((void)0)
+#define ROM_uDMAChannelAttributeEnable(a,b)  uDMAChannelAttributeEnable(a,b)
+#define ROM_uDMAChannelAttributeDisable(a,b) uDMAChannelAttributeDisable(a,b)
+#define ROM_FlashErase(a)       FlashErase(a)
+#define ROM_FlashProgram(a,b,c) FlashProgram(a,b,c)
+
+#endif
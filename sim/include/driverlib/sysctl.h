@@ -0,0 +1,7 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_SYSCTL_H__
+#define __SIM_SYSCTL_H__
+
+
+#endif
@@ -0,0 +1,15 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_UDMA_H__
+#define __SIM_UDMA_H__
+
+#include <stdint.h>
+
+#define UDMA_CHANNEL_USBEP1RX 0
+#define UDMA_ATTR_REQMASK     0x00000008
+
+// Only the request mask of the mass storage channel is tracked, see simWrite
+void uDMAChannelAttributeEnable(uint32_t channel, uint32_t attributes);
+void uDMAChannelAttributeDisable(uint32_t channel, uint32_t attributes);
+
+#endif
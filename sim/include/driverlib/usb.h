@@ -0,0 +1,28 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_USB_H__
+#define __SIM_USB_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define USB_EP_0 0x00000000
+#define USB_EP_1 0x00000010
+#define USBEPToIndex(x) ((x) >> 4)
+#define IndexToUSBEP(x) ((x) << 4)
+
+#define USB_TRANS_IN 0x00000102
+#define USB_INTEP_DEV_OUT_1 0x00020000
+
+#define USBDevEndpointDataAck(base, endpoint, isLastPacket) ((void)0)
+
+// Masking the endpoint interrupt has no effect here, see simWrite
+void USBIntEnableEndpoint(uint32_t base, uint32_t flags);
+void USBIntDisableEndpoint(uint32_t base, uint32_t flags);
+
+// Bulk endpoints, see simBulkOut and simBulkIn
+int32_t USBEndpointDataGet(uint32_t base, uint32_t endpoint, uint8_t *data, uint32_t *size);
+int32_t USBEndpointDataPut(uint32_t base, uint32_t endpoint, uint8_t *data, uint32_t size);
+int32_t USBEndpointDataSend(uint32_t base, uint32_t endpoint, uint32_t transactionType);
+
+#endif
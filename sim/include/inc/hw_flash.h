@@ -0,0 +1,8 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_HW_FLASH_H__
+#define __SIM_HW_FLASH_H__
+
+#define FLASH_ERASE_SIZE 0x00000400
+
+#endif
@@ -0,0 +1,7 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_HW_INTS_H__
+#define __SIM_HW_INTS_H__
+
+#define INT_USB0 60
+#endif
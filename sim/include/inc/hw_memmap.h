@@ -0,0 +1,8 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_HW_MEMMAP_H__
+#define __SIM_HW_MEMMAP_H__
+
+#define USB0_BASE 0x40050000
+
+#endif
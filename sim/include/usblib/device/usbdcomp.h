@@ -0,0 +1,14 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_USBDCOMP_H__
+#define __SIM_USBDCOMP_H__
+
+#include <stdint.h>
+
+typedef struct {
+	const tDeviceInfo *psDevInfo;
+	void *pvInstance;
+	uint32_t ui32DeviceWorkspace;
+} tCompositeEntry;
+
+#endif
@@ -0,0 +1,14 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_USBDEVICE_H__
+#define __SIM_USBDEVICE_H__
+
+#include <stdint.h>
+
+void USBDCDTerm(uint32_t index);
+// Endpoint 0 as seen by the interfaces, sim.c hands the data to and from simControl
+void USBDCDSendDataEP0(uint32_t index, uint8_t *data, uint32_t size);
+void USBDCDRequestDataEP0(uint32_t index, uint8_t *data, uint32_t size);
+void USBDCDStallEP0(uint32_t index);
+
+#endif
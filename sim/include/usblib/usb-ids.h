@@ -0,0 +1,10 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_USB_IDS_H__
+#define __SIM_USB_IDS_H__
+
+#define USB_VID_TI_1CBE 0x1CBE
+#define USB_PID_BULK    0x0003
+#define USB_PID_DFU     0x00FF
+
+#endif
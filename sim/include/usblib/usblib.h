@@ -0,0 +1,77 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_USBLIB_H__
+#define __SIM_USBLIB_H__
+
+#include <stdint.h>
+
+// The parts of usblib's class driver interface that the interfaces besides mass storage use
+typedef struct {
+	uint8_t bmRequestType;
+	uint8_t bRequest;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+} __attribute__ ((packed)) tUSBRequest;
+
+#define USBShort(x) ((x) & 0xFF), (((x) >> 8) & 0xFF)
+
+#define USB_RTYPE_DIR_IN        0x80
+#define USB_RTYPE_TYPE_M        0x60
+#define USB_RTYPE_CLASS         0x20
+#define USB_RTYPE_VENDOR        0x40
+#define USB_RTYPE_INTERFACE     0x01
+#define USB_DTYPE_DEVICE        1
+#define USB_DTYPE_CONFIGURATION 2
+#define USB_DTYPE_INTERFACE     4
+#define USB_DTYPE_ENDPOINT      5
+#define USB_CLASS_APP_SPECIFIC  0xFE
+#define USB_CLASS_VEND_SPECIFIC 0xFF
+#define USB_CONF_ATTR_SELF_PWR  0xC0
+#define USB_EP_DESC_OUT         0x00
+#define USB_EP_DESC_IN          0x80
+#define USB_EP_ATTR_BULK        0x02
+
+#define USB_EVENT_COMP_EP_CHANGE 0x0000000E
+
+typedef struct {
+	uint16_t ui16Size;
+	const uint8_t *pui8Data;
+} tConfigSection;
+
+typedef struct {
+	uint8_t ui8NumSections;
+	const tConfigSection * const *psSections;
+} tConfigHeader;
+
+typedef void (*tStdRequest)(void *instance, tUSBRequest *request);
+typedef void (*tInfoCallback)(void *instance, uint32_t info);
+typedef void (*tInterfaceCallback)(void *instance, uint8_t interface, uint8_t alternateSetting);
+typedef void (*tUSBIntHandler)(void *instance);
+typedef void (*tUSBEPIntHandler)(void *instance, uint32_t status);
+typedef void (*tUSBDeviceHandler)(void *instance, uint32_t request, void *requestData);
+
+typedef struct {
+	tStdRequest pfnGetDescriptor;
+	tStdRequest pfnRequestHandler;
+	tInterfaceCallback pfnInterfaceChange;
+	tInfoCallback pfnConfigChange;
+	tInfoCallback pfnDataReceived;
+	tInfoCallback pfnDataSent;
+	tUSBIntHandler pfnResetHandler;
+	tUSBIntHandler pfnSuspendHandler;
+	tUSBIntHandler pfnResumeHandler;
+	tUSBIntHandler pfnDisconnectHandler;
+	tUSBEPIntHandler pfnEndpointHandler;
+	tUSBDeviceHandler pfnDeviceHandler;
+} tCustomHandlers;
+
+typedef struct {
+	const tCustomHandlers *psCallbacks;
+	const uint8_t *pui8DeviceDescriptor;
+	const tConfigHeader * const *ppsConfigDescriptors;
+	const uint8_t * const *ppui8StringDescriptors;
+	uint32_t ui32NumStringDescriptors;
+} tDeviceInfo;
+
+#endif
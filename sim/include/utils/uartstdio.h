@@ -0,0 +1,10 @@
+// Host simulation stand-in, see sim/README
+
+#ifndef __SIM_UARTSTDIO_H__
+#define __SIM_UARTSTDIO_H__
+
+#include <stdio.h>
+
+#define UARTprintf printf
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Copies firmware files onto the simulated drive and reports what it cost.
+// Usage: msc-sim [-e erase us] [-p program us] [-u usb block us] [-t trace] [-v] firmware.bin...
+// -v reads the file back before the eject, as tools/gangflash verifies. With VERIFY it asks
+// VERIFY.TXT for the CRC32 of the upload instead, as tools/gangflash does then.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "common.h"
+#include "ramdisk.h"
+
+#ifdef VERIFY
+#include "crc32.h"
+#endif
+
+// Layout of the drive, from the boot sector like a host would take it
+static unsigned long sectorsPerCluster, fatStart, fatSectors, fatCopies, rootStart, dataStart, clusters;
+static bool verify;
+
+static unsigned int fatEntry(const unsigned char *fat, unsigned long cluster)
+{
+	const unsigned char *entry = fat + cluster * 3 / 2;
+	return cluster & 1 ? (entry[0] >> 4 | entry[1] << 4) : (entry[0] | (entry[1] & 0x0F) << 8);
+}
+
+static void setFatEntry(unsigned char *fat, unsigned long cluster, unsigned int value)
+{
+	unsigned char *entry = fat + cluster * 3 / 2;
+	if (cluster & 1) {
+		entry[0] = (entry[0] & 0x0F) | (value << 4 & 0xF0);
+		entry[1] = value >> 4;
+	}
+	else {
+		entry[0] = value;
+		entry[1] = (entry[1] & 0xF0) | (value >> 8 & 0x0F);
+	}
+}
+
+#ifdef VERIFY
+// Writes the CRC32 request for the upload into VERIFY.TXT and reads it until the answer is
+// there. Returns true if it matches the file.
+static bool verifyQuery(const unsigned char *image, size_t length)
+{
+	unsigned char block[SIM_BLOCK_SIZE];
+	unsigned long query = 0;
+	simRead(rootStart, block, 1);
+	for (int i = 0; i < SIM_BLOCK_SIZE; i += 32) {
+		if (memcmp(block + i, "VERIFY  TXT", 11) == 0)
+			query = dataStart + ((block[i + 26] | block[i + 27] << 8) - 2) * sectorsPerCluster;
+	}
+	unsigned long upload, crc;
+	simRead(query, block, 1);
+	if (!query || sscanf((const char *)block, "upload %lx", &upload) != 1)
+		return false;
+
+	memset(block, 0, sizeof(block));
+	snprintf((char *)block, sizeof(block), "crc32 0x%08lx %zu\n", upload, length);
+	simWrite(query, block, 1);
+	for (int tries = 0; tries < 100; tries++) {
+		simRead(query, block, 1);
+		const char *answer = strchr((const char *)block, '\n') + 1;
+		if (strncmp(answer, "busy", 4) != 0)
+			return sscanf(answer, "crc32 %*s %*s %lx", &crc) == 1 && crc == crc32Update(0, image, length);
+		simIdle(1000);
+	}
+	return false;
+}
+#endif
+
+// Copies one file onto the drive, ejects it and prints what happened. Returns true if
+// the bootloader would start it.
+static bool upload(const char *name)
+{
+	static unsigned char image[FLASH_SIZE];
+	FILE *f = fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		return false;
+	}
+	const size_t length = fread(image, 1, sizeof(image), f);
+	fclose(f);
+	const unsigned long blocks = (length + SIM_BLOCK_SIZE - 1) / SIM_BLOCK_SIZE;
+	const unsigned long fileClusters = (blocks + sectorsPerCluster - 1) / sectorsPerCluster;
+
+	// Like a simple host, put the file in the first free clusters, in one piece
+	unsigned char fat[16 * SIM_BLOCK_SIZE];
+	simRead(fatStart, fat, fatSectors);
+	unsigned long first = 2;
+	for (unsigned long cluster = 2; cluster < clusters + 2 && cluster - first < fileClusters; cluster++) {
+		if (fatEntry(fat, cluster) != 0)
+			first = cluster + 1;
+	}
+	if (length > SLOT_LENGTH || first + fileClusters > clusters + 2) {
+		fprintf(stderr, "%s does not fit in a slot (%u bytes) or on the drive\n", name, SLOT_LENGTH);
+		return false;
+	}
+
+	const uint64_t started = simElapsed();
+	memset(&simStats, 0, sizeof(simStats));
+	simWrite(dataStart + (first - 2) * sectorsPerCluster, image, blocks);
+	if (verify) {
+		const uint64_t verifyStarted = simElapsed();
+#ifdef VERIFY
+		const bool matches = verifyQuery(image, length);
+#else
+		static unsigned char readBack[FLASH_SIZE];
+		simRead(dataStart + (first - 2) * sectorsPerCluster, readBack, blocks);
+		const bool matches = memcmp(readBack, image, length) == 0;
+#endif
+		printf("%s %s the file in %.1f ms\n",
+#ifdef VERIFY
+		       "CRC32 query",
+#else
+		       "Read back",
+#endif
+		       matches ? "matches" : "differs from", (simElapsed() - verifyStarted) / 1000.0);
+	}
+	// The FAT after the data, as Linux writes it on sync
+	for (unsigned long i = 0; i < fileClusters; i++)
+		setFatEntry(fat, first + i, i + 1 < fileClusters ? first + i + 1 : 0xFFF);
+	for (unsigned long i = 0; i < fatCopies; i++)
+		simWrite(fatStart + i * fatSectors, fat, fatSectors);
+	simEject();
+
+	printf("%s: %zu bytes in %lu blocks\n", name, length, blocks);
+	return simReport(image, length, started);
+}
+
+int main(int argc, char **argv)
+{
+	int option;
+	while ((option = getopt(argc, argv, "e:p:u:t:v")) != -1) {
+		switch (option) {
+		case 'e': simTiming.erase = atoi(optarg); break;
+		case 'p': simTiming.program = atoi(optarg); break;
+		case 'u': simTiming.usbBlock = atoi(optarg); break;
+		case 't':
+			// Record what this host does, e.g. as a starting point for trace-replay
+			if (!(simTrace = fopen(optarg, "w"))) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'v': verify = true; break;
+		default: optind = argc; break;
+		}
+	}
+	if (optind == argc) {
+		fprintf(stderr, "Usage: msc-sim [-e erase us] [-p program us] [-u usb block us] [-t trace] [-v] firmware.bin...\n");
+		return 1;
+	}
+
+	simFlashInit();
+
+	unsigned char sector[SIM_BLOCK_SIZE];
+	simRead(0, sector, 1);
+	sectorsPerCluster = sector[13];
+	fatStart = sector[14] | sector[15] << 8;
+	fatCopies = sector[16];
+	fatSectors = sector[22] | sector[23] << 8;
+	rootStart = fatStart + fatCopies * fatSectors;
+	dataStart = rootStart + (sector[17] | sector[18] << 8) * 32 / SIM_BLOCK_SIZE;
+	clusters = ((sector[19] | sector[20] << 8) - dataStart) / sectorsPerCluster;
+
+	// The files are uploaded one after the other, e.g. a full image and then a patch against it
+	bool ok = true;
+	for (int i = optind; i < argc; i++)
+		ok &= upload(argv[i]);
+	return ok ? 0 : 2;
+}
@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "common.h"
+#include "ramdisk.h"
+#include "sched.h"
+#include "bootctl.h"
+
+#include "driverlib/udma.h"
+#include "driverlib/usb.h"
+
+#ifdef CRC32
+#include "crc32.h"
+#endif
+
+#ifdef CRYPTO
+#include "crypto/crypto.h"
+#endif
+
+// Stand-ins for sched.c: tasks queue up here and run when the simulated CPU gets to them
+#define TASKS 16
+
+static SchedTask tasks[TASKS];
+static unsigned int taskHead, taskTail;
+
+static uint64_t now;      // Clock of whatever runs right now
+static uint64_t hostTime; // When the host is done with its last transfer
+static uint64_t cpuTime;  // When the main loop is done with its last task
+static bool mscDmaMasked; // The mass storage OUT endpoint is held back, the host is NAKed
+
+static int drive;
+
+FILE *simTrace;
+
+void simAdvance(uint32_t duration)
+{
+	now += duration;
+}
+
+uint64_t simElapsed(void)
+{
+	return hostTime > cpuTime ? hostTime : cpuTime;
+}
+
+bool schedPost(SchedTask task)
+{
+	for (unsigned int i = taskHead; i != taskTail; i++) {
+		if (tasks[i % TASKS] == task)
+			return true;
+	}
+	if (taskTail - taskHead == TASKS)
+		return false;
+	tasks[taskTail++ % TASKS] = task;
+	return true;
+}
+
+uint32_t schedTicks(void)
+{
+	return now / (1000000 / SCHED_TICK_HZ);
+}
+
+void uDMAChannelAttributeEnable(uint32_t channel, uint32_t attributes)
+{
+	if (channel == UDMA_CHANNEL_USBEP1RX && (attributes & UDMA_ATTR_REQMASK))
+		mscDmaMasked = true;
+}
+
+void uDMAChannelAttributeDisable(uint32_t channel, uint32_t attributes)
+{
+	if (channel == UDMA_CHANNEL_USBEP1RX && (attributes & UDMA_ATTR_REQMASK))
+		mscDmaMasked = false;
+}
+
+// Mass storage takes its packets by uDMA, the request mask alone holds it back here
+void USBIntEnableEndpoint(uint32_t base, uint32_t flags)
+{
+}
+
+void USBIntDisableEndpoint(uint32_t base, uint32_t flags)
+{
+}
+
+void USBDCDTerm(uint32_t index)
+{
+}
+
+// Endpoint 0 of the control transfer in progress
+static uint8_t *ep0Out;
+static uint32_t ep0OutSize;
+static const uint8_t *ep0In;
+static uint32_t ep0InSize;
+static bool ep0Stalled;
+
+void USBDCDSendDataEP0(uint32_t index, uint8_t *data, uint32_t size)
+{
+	ep0In = data;
+	ep0InSize = size;
+}
+
+void USBDCDRequestDataEP0(uint32_t index, uint8_t *data, uint32_t size)
+{
+	ep0Out = data;
+	ep0OutSize = size;
+}
+
+void USBDCDStallEP0(uint32_t index)
+{
+	ep0Stalled = true;
+}
+
+// The packets on the bulk endpoints
+static const uint8_t *bulkOut;
+static uint32_t bulkOutSize;
+static bool bulkOutPending; // The packet has not been read from the FIFO yet
+static uint8_t bulkIn[SIM_BULK_PACKET_SIZE];
+static uint32_t bulkInSize;
+static bool bulkInReady;
+
+int32_t USBEndpointDataGet(uint32_t base, uint32_t endpoint, uint8_t *data, uint32_t *size)
+{
+	if (*size > bulkOutSize)
+		*size = bulkOutSize;
+	memcpy(data, bulkOut, *size);
+	bulkOutPending = false;
+	return 0;
+}
+
+int32_t USBEndpointDataPut(uint32_t base, uint32_t endpoint, uint8_t *data, uint32_t size)
+{
+	if (bulkInReady || bulkInSize + size > sizeof(bulkIn))
+		return -1;
+	memcpy(bulkIn + bulkInSize, data, size);
+	bulkInSize += size;
+	return 0;
+}
+
+int32_t USBEndpointDataSend(uint32_t base, uint32_t endpoint, uint32_t transactionType)
+{
+	bulkInReady = true;
+	return 0;
+}
+
+// The real one boots the image, here it only reports whether that would be allowed
+void CallUserProgram(void)
+{
+	simStats.booted = true;
+	simStats.bootValid = true;
+#ifdef CRC32
+	simStats.bootValid &= checkImageCrc(uploadStart + UPLOAD_CODE_OFFSET, SLOT_LENGTH - UPLOAD_CODE_OFFSET);
+#endif
+#ifdef CRYPTO
+	simStats.bootValid &= checkCryptoSignature(uploadStart) != 0;
+#endif
+#ifdef DUALSLOT
+	// Switch over so the next upload goes to the other slot
+	if (simStats.bootValid)
+		setBootState(uploadStart, BOOT_NEW);
+#endif
+}
+
+static void runTask(void)
+{
+	SchedTask task = tasks[taskHead++ % TASKS];
+	now = cpuTime > hostTime ? cpuTime : hostTime;
+	task();
+	cpuTime = now;
+}
+
+// Runs the queued tasks that the CPU gets to before the host's next transfer, or all of them
+static void runTasks(bool all)
+{
+	while (taskHead != taskTail && (all || cpuTime <= hostTime))
+		runTask();
+}
+
+// The host is NAKed while held is set, it retries until a task has cleared it
+static void waitWhile(const bool *held)
+{
+	if (!*held)
+		return;
+	simStats.stalls++;
+	while (*held && taskHead != taskTail)
+		runTask();
+	if (hostTime < cpuTime)
+		hostTime = cpuTime;
+}
+
+// The host's next transfer, it takes duration
+static void beginTransfer(uint32_t duration)
+{
+	hostTime += duration;
+	now = hostTime;
+}
+
+unsigned long simRead(unsigned long block, unsigned char *data, unsigned long count)
+{
+	unsigned long read = 0;
+	if (simTrace)
+		fprintf(simTrace, "R %lu %lu\n", block, count);
+	for (unsigned long i = 0; i < count; i++) {
+		hostTime += simTiming.usbBlock;
+		now = hostTime;
+		read += massStorageRead(&drive, data + i * SIM_BLOCK_SIZE, block + i, 1);
+		runTasks(false);
+	}
+	return read;
+}
+
+unsigned long simWrite(unsigned long block, const unsigned char *data, unsigned long count)
+{
+	unsigned long written = 0;
+	if (simTrace) {
+		fprintf(simTrace, "W %lu %lu hex:", block, count);
+		for (unsigned long i = 0; i < count * SIM_BLOCK_SIZE; i++)
+			fprintf(simTrace, "%02x", data[i]);
+		fprintf(simTrace, "\n");
+	}
+	for (unsigned long i = 0; i < count; i++) {
+		// usblib hands over one block at a time, in its own buffer
+		unsigned char buffer[SIM_BLOCK_SIZE] __attribute__ ((aligned(4)));
+
+		// The controller NAKs the block while its uDMA request is masked
+		waitWhile(&mscDmaMasked);
+		beginTransfer(simTiming.usbBlock);
+		memcpy(buffer, data + i * SIM_BLOCK_SIZE, SIM_BLOCK_SIZE);
+		const unsigned long taken = massStorageWrite(&drive, buffer, block + i, 1);
+		written += taken;
+		runTasks(false);
+		// usblib fails the whole SCSI WRITE when a block is not taken, the host sees an error
+		if (taken < SIM_BLOCK_SIZE) {
+			simStats.failedWrites++;
+			break;
+		}
+	}
+	return written;
+}
+
+long simControl(const tDeviceInfo *device, void *instance, tUSBRequest *request, unsigned char *data)
+{
+	const tCustomHandlers *handlers = device->psCallbacks;
+	long transferred = 0;
+
+	ep0Out = NULL;
+	ep0In = NULL;
+	ep0Stalled = false;
+	beginTransfer(simTiming.control);
+	handlers->pfnRequestHandler(instance, request);
+	if (ep0Out) {
+		transferred = ep0OutSize < request->wLength ? ep0OutSize : request->wLength;
+		memcpy(ep0Out, data, transferred);
+		handlers->pfnDataReceived(instance, 0);
+	}
+	else if (ep0In) {
+		transferred = ep0InSize < request->wLength ? ep0InSize : request->wLength;
+		memcpy(data, ep0In, transferred);
+		if (handlers->pfnDataSent)
+			handlers->pfnDataSent(instance, 0);
+	}
+	runTasks(false);
+	return ep0Stalled ? -1 : transferred;
+}
+
+long simBulkOut(const tDeviceInfo *device, void *instance, const unsigned char *data, unsigned long length)
+{
+	for (unsigned long sent = 0; sent < length; sent += SIM_BULK_PACKET_SIZE) {
+		beginTransfer(simTiming.usbBlock / (SIM_BLOCK_SIZE / SIM_BULK_PACKET_SIZE));
+		bulkOut = data + sent;
+		bulkOutSize = length - sent < SIM_BULK_PACKET_SIZE ? length - sent : SIM_BULK_PACKET_SIZE;
+		bulkOutPending = true;
+		device->psCallbacks->pfnEndpointHandler(instance, 0x10000 << USBEPToIndex(USB_EP_1));
+		// The next packet is NAKed until the device has taken this one out of the FIFO
+		waitWhile(&bulkOutPending);
+		runTasks(false);
+	}
+	return length;
+}
+
+long simBulkIn(const tDeviceInfo *device, void *instance, unsigned char *data, unsigned long length)
+{
+	unsigned long received = 0;
+	while (received < length) {
+		if (!bulkInReady) {
+			// NAKed until the device has something, e.g. a reply from a task
+			runTasks(true);
+			if (hostTime < cpuTime)
+				hostTime = cpuTime;
+			if (!bulkInReady)
+				return received ? (long)received : -1;
+		}
+		beginTransfer(simTiming.usbBlock / (SIM_BLOCK_SIZE / SIM_BULK_PACKET_SIZE));
+		const uint32_t size = bulkInSize < length - received ? bulkInSize : length - received;
+		memcpy(data + received, bulkIn, size);
+		received += size;
+		bulkInSize = 0;
+		bulkInReady = false;
+		device->psCallbacks->pfnEndpointHandler(instance, 1 << USBEPToIndex(USB_EP_1));
+		runTasks(false);
+		if (size < SIM_BULK_PACKET_SIZE)
+			break;
+	}
+	return received;
+}
+
+void simIdle(uint64_t duration)
+{
+	if (simTrace)
+		fprintf(simTrace, "I %lu\n", (unsigned long)(duration / 1000));
+	hostTime += duration;
+	runTasks(false);
+}
+
+void simEject(void)
+{
+	if (simTrace)
+		fprintf(simTrace, "E\n");
+	now = hostTime;
+	massStorageClose(&drive);
+	simFinish();
+}
+
+void simFinish(void)
+{
+	runTasks(true);
+}
+
+bool simReport(const unsigned char *image, size_t length, uint64_t started)
+{
+	// Patches and encrypted files leave something else in flash, the signature check tells
+	const bool matches = memcmp(simFlash(uploadStart), image, length) == 0;
+
+	printf("Flash: %lu erases, %lu programs, %lu bytes programmed to 0x%lx, %.1f ms busy\n",
+	       simStats.erases, simStats.programs, simStats.programmedBytes, uploadStart - FLASH_BASE, simStats.flashTime / 1000.0);
+	printf("Elapsed: %.1f ms, %lu blocks held back by a full write queue\n", (simElapsed() - started) / 1000.0, simStats.stalls);
+	if (simStats.programErrors)
+		printf("Programmed %lu words that were not erased\n", simStats.programErrors);
+	if (simStats.failedWrites)
+		printf("%lu SCSI WRITEs failed, a block was not taken\n", simStats.failedWrites);
+	printf("Flash %s the image\n", matches ? "matches" : "differs from");
+	printf("Boot check: %s\n", !simStats.booted ? "not reached" : simStats.bootValid ? "passed" : "failed");
+
+	const char *failure = NULL;
+#ifndef CRYPTO
+	if (!matches)
+		failure = "the flash differs from the image";
+#endif
+	if (simStats.programErrors)
+		failure = "words were programmed without an erase";
+	if (simStats.failedWrites)
+		failure = "the host saw a failed write";
+	if (!simStats.booted || !simStats.bootValid)
+		failure = "the image would not boot";
+	if (failure)
+		printf("Result: FAILED, %s\n\n", failure);
+	else
+		printf("Result: passed\n\n");
+	return failure == NULL;
+}
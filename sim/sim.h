@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "usblib/usblib.h"
+
+// The simulated flash is mapped at FLASH_BASE (set by the sim target) so that addresses
+// still fit in the 32 bits the flash functions take, its size is FLASH_SIZE
+#define SIM_BLOCK_SIZE (512)
+
+// Durations in microseconds, rough TM4C123 figures by default
+typedef struct {
+	uint32_t erase;    // Erasing one 1 kB page
+	uint32_t program;  // Programming one word
+	uint32_t usbBlock; // Transferring one 512 byte block over full speed USB
+	uint32_t control;  // A control transfer of up to 512 bytes, at least a frame
+} SimTiming;
+
+typedef struct {
+	unsigned long erases;
+	unsigned long programs;        // FlashProgram calls
+	unsigned long programmedBytes;
+	unsigned long programErrors;   // Words that needed a bit set from 0 to 1, i.e. missed an erase
+	uint64_t flashTime;            // Time spent erasing and programming
+	unsigned long stalls;          // Transfers the host was NAKed for while the write queue was full
+	unsigned long failedWrites;    // SCSI WRITEs that failed because the device did not take a block
+	bool booted;                   // CallUserProgram was reached
+	bool bootValid;                // The image passed the checks that were built in
+} SimStats;
+
+extern SimTiming simTiming;
+extern SimStats simStats;
+// If set, simRead and simWrite log every transfer to it in the trace format (sim/README)
+extern FILE *simTrace;
+
+// Maps and erases the flash, call first
+void simFlashInit(void);
+// Pointer to the simulated flash at the given address
+unsigned char *simFlash(unsigned long address);
+// Advances the clock of whatever is running, used by the flash functions
+void simAdvance(uint32_t duration);
+
+// The MSC callbacks as a block device. The USB interrupt runs on the host's clock and the
+// queued tasks on the CPU's clock, which may run ahead of it. Tasks are not preempted.
+// Both return the bytes transferred, simWrite stops at a block the device does not take
+// since usblib fails the command there.
+unsigned long simRead(unsigned long block, unsigned char *data, unsigned long count);
+unsigned long simWrite(unsigned long block, const unsigned char *data, unsigned long count);
+// A control transfer to an interface other than mass storage: calls its request handler,
+// hands it data for an OUT request or copies what it sends into data. Returns the bytes
+// transferred or -1 if the request was stalled.
+long simControl(const tDeviceInfo *device, void *instance, tUSBRequest *request, unsigned char *data);
+// Bulk transfers on endpoint 1 of such an interface, in packets of SIM_BULK_PACKET_SIZE
+// bytes. simBulkOut hands each packet to the endpoint handler, simBulkIn collects what
+// the device sends until length bytes or a short packet and gives the tasks time to
+// answer first. Both return the bytes transferred, simBulkIn -1 if nothing came.
+#define SIM_BULK_PACKET_SIZE (64)
+long simBulkOut(const tDeviceInfo *device, void *instance, const unsigned char *data, unsigned long length);
+long simBulkIn(const tDeviceInfo *device, void *instance, unsigned char *data, unsigned long length);
+// The host does nothing for the given number of microseconds, queued tasks may run
+void simIdle(uint64_t duration);
+// Ejects the drive and runs everything that is left
+void simEject(void);
+// Runs everything that is left, e.g. after a DFU download
+void simFinish(void);
+// Simulated time since the start in microseconds
+uint64_t simElapsed(void);
+// Prints the statistics and whether the upload slot holds image, as of the given start
+// time. Returns true if the image is there (or passes the signature check with CRYPTO)
+// and would boot.
+bool simReport(const unsigned char *image, size_t length, uint64_t started);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+
+// Replays a block trace of a host copying a file onto the drive, see sim/README.
+// Usage: trace-replay [-e erase us] [-p program us] [-u usb block us] trace image.bin
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "common.h"
+
+#define MAX_BLOCKS 1024 // The whole drive
+
+static unsigned char image[FLASH_SIZE];
+static size_t imageLength;
+static unsigned long imageBlocksUsed; // The highest image block the trace refers to, plus one
+
+static int hexDigit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// Fills data with count blocks as described by the data field of a W line. Returns false
+// if it cannot be parsed.
+static bool traceData(const char *field, unsigned char *data, unsigned long count)
+{
+	const size_t size = count * SIM_BLOCK_SIZE;
+	unsigned long block, length, fill;
+
+	memset(data, 0, size);
+	if (strcmp(field, "zero") == 0)
+		return true;
+	if (sscanf(field, "fill:%lx", &fill) == 1) {
+		memset(data, fill, size);
+		return true;
+	}
+	if (strncmp(field, "hex:", 4) == 0) {
+		field += 4;
+		for (size_t i = 0; i < size && field[0] && field[1]; i++, field += 2) {
+			const int high = hexDigit(field[0]), low = hexDigit(field[1]);
+			if (high < 0 || low < 0)
+				return false;
+			data[i] = high << 4 | low;
+		}
+		return true;
+	}
+	// The file being copied, optionally only its first length bytes from that block on
+	const int fields = sscanf(field, "image:%lu,%lu", &block, &length);
+	if (fields < 1)
+		return false;
+	if (fields < 2 || length > size)
+		length = size;
+	if (block + count > imageBlocksUsed)
+		imageBlocksUsed = block + count;
+	const size_t offset = block * SIM_BLOCK_SIZE;
+	if (offset < imageLength)
+		memcpy(data, image + offset, offset + length > imageLength ? imageLength - offset : length);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int option;
+	while ((option = getopt(argc, argv, "e:p:u:")) != -1) {
+		switch (option) {
+		case 'e': simTiming.erase = atoi(optarg); break;
+		case 'p': simTiming.program = atoi(optarg); break;
+		case 'u': simTiming.usbBlock = atoi(optarg); break;
+		default: optind = argc; break;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "Usage: trace-replay [-e erase us] [-p program us] [-u usb block us] trace image.bin\n");
+		return 1;
+	}
+
+	FILE *f = fopen(argv[optind + 1], "rb");
+	if (!f) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+	imageLength = fread(image, 1, sizeof(image), f);
+	fclose(f);
+	FILE *trace = fopen(argv[optind], "r");
+	if (!trace) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	simFlashInit();
+
+	static unsigned char data[MAX_BLOCKS * SIM_BLOCK_SIZE];
+	unsigned long reads = 0, writes = 0, lineNumber = 0;
+	bool ejected = false;
+	char *line = NULL;
+	size_t lineSize = 0;
+	while (getline(&line, &lineSize, trace) != -1) {
+		unsigned long block, count, duration;
+		char field[16];
+		int consumed;
+
+		lineNumber++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || line[strspn(line, " \t")] == '\0')
+			continue;
+		if (ejected) {
+			fprintf(stderr, "%s:%lu: transfer after the eject\n", argv[optind], lineNumber);
+			return 1;
+		}
+		if (sscanf(line, "R %lu %lu", &block, &count) == 2 && block + count <= MAX_BLOCKS) {
+			simRead(block, data, count);
+			reads += count;
+		}
+		else if (sscanf(line, "W %lu %lu %n", &block, &count, &consumed) == 2 && block + count <= MAX_BLOCKS &&
+		         traceData(line + consumed, data, count)) {
+			simWrite(block, data, count);
+			writes += count;
+		}
+		else if (sscanf(line, "I %lu", &duration) == 1) {
+			simIdle(duration * 1000);
+		}
+		else if (sscanf(line, "%15s", field) == 1 && strcmp(field, "E") == 0) {
+			simEject();
+			ejected = true;
+		}
+		else {
+			fprintf(stderr, "%s:%lu: cannot parse \"%.40s\"\n", argv[optind], lineNumber, line);
+			return 1;
+		}
+	}
+	free(line);
+	fclose(trace);
+	if (!ejected)
+		simEject();
+
+	if (imageBlocksUsed * SIM_BLOCK_SIZE < imageLength)
+		printf("Warning: the trace only copies the first %lu bytes of %s\n", imageBlocksUsed * SIM_BLOCK_SIZE, argv[optind + 1]);
+	printf("%s: %lu blocks read, %lu written, %s: %zu bytes\n", argv[optind], reads, writes, argv[optind + 1], imageLength);
+	return simReport(image, imageLength, 0) ? 0 : 2;
+}
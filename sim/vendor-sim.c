@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Flashes a firmware file through the vendor bulk interface the way tools/bulkflash
+// does and reports what it cost, for comparison with msc-sim and dfu-sim.
+// Usage: vendor-sim [-e erase us] [-p program us] [-u block us] [-n] firmware.bin
+// -n skips the CRC check, encrypted files and patches leave something else in flash and
+// NOREAD builds do not answer it.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "common.h"
+#include "crc32.h"
+#include "crypto/crypto.h"
+#include "ramdisk.h"
+#include "usblib/device/usbdcomp.h"
+#include "usb_vendor.h"
+#include "vendor_protocol.h"
+
+static tCompositeEntry vendor;
+
+// The CRC32 of what the image leaves in flash, see inFlash in tools/bulkflash
+static uint32_t flashCrc(const unsigned char *image, uint32_t length)
+{
+	uint32_t ahead = 0;
+	if (length >= 32 && image[0] == 'Z' && image[1] == '-' && image[8] == FORMAT_PAGES && image[9] < 32) {
+		const uint32_t codeSize = image[2] | image[3] << 8 | image[4] << 16 | (uint32_t)image[5] << 24;
+		const uint32_t signSize = image[6] | image[7] << 8;
+		ahead = (32 + (32 + codeSize) / (1u << image[9]) * 32 + signSize + 511) / 512 * 512;
+		if (ahead > length)
+			ahead = 0;
+	}
+	return crc32Update(crc32Update(0, image + ahead, length - ahead), image, ahead);
+}
+
+// Sends a command and reads its reply, returns the reply's status or -1
+static long vendorCommand(uint32_t command, uint32_t address, uint32_t length, const unsigned char *data, uint32_t *value)
+{
+	const VendorCommand packet = { VENDOR_MAGIC, command, address, length };
+	VendorReply reply;
+
+	simBulkOut(vendor.psDevInfo, vendor.pvInstance, (const unsigned char *)&packet, sizeof(packet));
+	if (data)
+		simBulkOut(vendor.psDevInfo, vendor.pvInstance, data, length);
+	if (simBulkIn(vendor.psDevInfo, vendor.pvInstance, (unsigned char *)&reply, sizeof(reply)) != sizeof(reply) ||
+	    reply.magic != VENDOR_MAGIC || reply.command != command)
+		return -1;
+	if (value)
+		*value = reply.value;
+	return reply.status;
+}
+
+int main(int argc, char **argv)
+{
+	bool checkCrc = true;
+	int option;
+	while ((option = getopt(argc, argv, "e:p:u:n")) != -1) {
+		switch (option) {
+		case 'e': simTiming.erase = atoi(optarg); break;
+		case 'p': simTiming.program = atoi(optarg); break;
+		case 'u': simTiming.usbBlock = atoi(optarg); break;
+		case 'n': checkCrc = false; break;
+		default: optind = argc; break;
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, "Usage: vendor-sim [-e erase us] [-p program us] [-u block us] [-n] firmware.bin\n");
+		return 1;
+	}
+
+	static unsigned char image[FLASH_SIZE];
+	FILE *f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	const size_t length = fread(image, 1, sizeof(image), f);
+	fclose(f);
+	// PROGRAM takes whole blocks, padded as erased flash
+	const uint32_t programLength = (length + VENDOR_BLOCK_SIZE - 1) / VENDOR_BLOCK_SIZE * VENDOR_BLOCK_SIZE;
+	memset(image + length, 0xFF, programLength - length);
+
+	simFlashInit();
+	vendorCompositeInit(&vendor);
+
+	// As tools/bulkflash: INFO, ERASE of the pages the image covers, PROGRAM, CRC, BOOT
+	VendorInfo info;
+	long status = vendorCommand(VENDOR_INFO, 0, 0, NULL, NULL);
+	if (status != VENDOR_OK || simBulkIn(vendor.psDevInfo, vendor.pvInstance, (unsigned char *)&info, sizeof(info)) != sizeof(info)) {
+		fprintf(stderr, "INFO failed\n");
+		return 2;
+	}
+	const uint64_t started = simElapsed();
+	uint32_t crc = 0;
+	const char *failed = NULL;
+	if (vendorCommand(VENDOR_ERASE, info.uploadSlot, (programLength + info.eraseSize - 1) / info.eraseSize * info.eraseSize, NULL, NULL) != VENDOR_OK)
+		failed = "ERASE";
+	else if (vendorCommand(VENDOR_PROGRAM, info.uploadSlot, programLength, image, NULL) != VENDOR_OK)
+		failed = "PROGRAM";
+	else if (checkCrc && (vendorCommand(VENDOR_CRC, info.uploadSlot, programLength, NULL, &crc) != VENDOR_OK || crc != flashCrc(image, programLength)))
+		failed = "CRC";
+	else if (vendorCommand(VENDOR_BOOT, 0, 0, NULL, NULL) != VENDOR_OK)
+		failed = "BOOT";
+	simFinish();
+
+	printf("%s: %zu bytes in one PROGRAM of %u bytes, %s\n", argv[optind], length, programLength, failed ? "failed" : checkCrc ? "CRC matches" : "CRC not checked");
+	if (failed)
+		printf("%s failed\n", failed);
+	return simReport(image, length, started) && !failed ? 0 : 2;
+}
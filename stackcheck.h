@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef __STACKCHECK_H__
+#define __STACKCHECK_H__
+
+#include <stdint.h>
+
+// With STACKCHECK the startup code paints the stack with STACK_PAINT below its own frame,
+// stackHighWater() then finds the deepest word that has been overwritten since. _sbrk
+// keeps heapPeak, the most the heap has taken, which only CRYPTO builds use (imath).
+// The console's memory query and the end of an upload print both.
+#define STACK_PAINT (0x4B435453) // "STCK"
+
+extern uint32_t stackSize(void);
+extern uint32_t stackHighWater(void);
+#ifdef CRYPTO
+extern uint32_t heapPeak;
+#endif
+
+#endif
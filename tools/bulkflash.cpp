@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Flashes firmware through the vendor specific bulk interface of a bootloader built
+// with VENDOR=1 and prints how long each step took, for scripts and for comparing with
+// copying the file to the drive. Needs libusb 1.0, "make tools" builds it.
+// Usage: bulkflash [-r] [-n] [-k] firmware.bin
+//   -r reads the image back and compares it (not with NOREAD=1)
+//   -n skips the CRC check, encrypted files and patches leave something else in flash
+//      and NOREAD=1 builds do not answer it
+//   -k keeps the bootloader running instead of starting the new image
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <libusb.h>
+
+#include "../vendor_protocol.h"
+
+static const uint16_t VID = 0x1CBE;
+static const uint16_t PID = 0x0120; // USB_PID_MSC_COMPOSITE in usb_config.h
+static const unsigned int TIMEOUT = 10000; // ms, ERASE of a whole slot takes a few seconds
+
+// Same as zlib's crc32() and crc32Update in crc32.c
+static uint32_t crc32(const std::vector<unsigned char> &data)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (unsigned char byte : data) {
+		crc ^= byte;
+		for (int bit = 0; bit < 8; bit++)
+			crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+// What the image leaves in flash. A format 1 file (crypto/signer/README) has its page table
+// and signature ahead of the code, the bootloader programs them after it.
+static std::vector<unsigned char> inFlash(const std::vector<unsigned char> &image)
+{
+	if (image.size() < 32 || image[0] != 'Z' || image[1] != '-' || image[8] != 1 || image[9] >= 32)
+		return image;
+	const uint32_t codeSize = image[2] | image[3] << 8 | image[4] << 16 | uint32_t(image[5]) << 24;
+	const uint32_t signSize = image[6] | image[7] << 8;
+	const size_t ahead = (32 + (32 + codeSize) / (1u << image[9]) * 32 + signSize + 511) / 512 * 512;
+	if (ahead > image.size())
+		return image;
+	std::vector<unsigned char> flash(image.begin() + ahead, image.end());
+	flash.insert(flash.end(), image.begin(), image.begin() + ahead);
+	return flash;
+}
+
+class Bootloader {
+public:
+	Bootloader()
+	{
+		check(libusb_init(&context), "libusb_init");
+		handle = libusb_open_device_with_vid_pid(context, VID, PID);
+		if (!handle)
+			throw std::runtime_error("no bootloader with a vendor interface found");
+		findInterface();
+		libusb_set_auto_detach_kernel_driver(handle, 1);
+		check(libusb_claim_interface(handle, interface), "libusb_claim_interface");
+	}
+
+	~Bootloader()
+	{
+		libusb_release_interface(handle, interface);
+		libusb_close(handle);
+		libusb_exit(context);
+	}
+
+	// Sends a command with its data and returns the reply's value, throws unless it succeeded
+	uint32_t command(uint32_t command, uint32_t address, uint32_t length, const unsigned char *data = nullptr)
+	{
+		const VendorCommand packet = { VENDOR_MAGIC, command, address, length };
+		write(reinterpret_cast<const unsigned char *>(&packet), sizeof(packet));
+		if (data)
+			write(data, length);
+
+		VendorReply reply;
+		read(reinterpret_cast<unsigned char *>(&reply), sizeof(reply));
+		if (reply.magic != VENDOR_MAGIC || reply.command != command)
+			throw std::runtime_error("unexpected reply");
+		if (reply.status != VENDOR_OK) {
+			static const char * const statuses[] = { "ok", "bad command", "bad range", "not supported", "bad image", "write failed" };
+			throw std::runtime_error(std::string("command failed: ") +
+			                         (reply.status < sizeof(statuses) / sizeof(statuses[0]) ? statuses[reply.status] : "unknown status"));
+		}
+		return reply.value;
+	}
+
+	void read(unsigned char *data, uint32_t length)
+	{
+		int transferred;
+		check(libusb_bulk_transfer(handle, inEndpoint, data, length, &transferred, TIMEOUT), "bulk IN");
+		if (static_cast<uint32_t>(transferred) != length)
+			throw std::runtime_error("short bulk IN transfer");
+	}
+
+private:
+	void write(const unsigned char *data, uint32_t length)
+	{
+		int transferred;
+		check(libusb_bulk_transfer(handle, outEndpoint, const_cast<unsigned char *>(data), length, &transferred, TIMEOUT), "bulk OUT");
+		if (static_cast<uint32_t>(transferred) != length)
+			throw std::runtime_error("short bulk OUT transfer");
+	}
+
+	// The composite device places the interface and its endpoints after mass storage
+	void findInterface()
+	{
+		libusb_config_descriptor *config;
+		check(libusb_get_active_config_descriptor(libusb_get_device(handle), &config), "libusb_get_active_config_descriptor");
+		for (int i = 0; i < config->bNumInterfaces; i++) {
+			const libusb_interface_descriptor &descriptor = config->interface[i].altsetting[0];
+			if (descriptor.bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC || descriptor.bNumEndpoints != 2)
+				continue;
+			interface = descriptor.bInterfaceNumber;
+			for (int e = 0; e < 2; e++) {
+				const uint8_t address = descriptor.endpoint[e].bEndpointAddress;
+				(address & LIBUSB_ENDPOINT_IN ? inEndpoint : outEndpoint) = address;
+			}
+		}
+		libusb_free_config_descriptor(config);
+		if (interface < 0)
+			throw std::runtime_error("the bootloader has no vendor interface, build it with VENDOR=1");
+	}
+
+	static void check(int result, const char *what)
+	{
+		if (result < 0)
+			throw std::runtime_error(std::string(what) + ": " + libusb_error_name(result));
+	}
+
+	libusb_context *context = nullptr;
+	libusb_device_handle *handle = nullptr;
+	int interface = -1;
+	uint8_t inEndpoint = 0, outEndpoint = 0;
+};
+
+// Runs one step and prints its duration and throughput
+template <typename Step>
+static void timed(const char *name, size_t bytes, Step step)
+{
+	const auto start = std::chrono::steady_clock::now();
+	step();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (bytes)
+		printf("%-8s %8.1f ms %8.1f KB/s\n", name, seconds * 1000, bytes / 1024.0 / seconds);
+	else
+		printf("%-8s %8.1f ms\n", name, seconds * 1000);
+}
+
+int main(int argc, char **argv)
+{
+	bool readBack = false, checkCrc = true, boot = true;
+	int option;
+	while ((option = getopt(argc, argv, "rnk")) != -1) {
+		switch (option) {
+		case 'r': readBack = true; break;
+		case 'n': checkCrc = false; break;
+		case 'k': boot = false; break;
+		default: optind = argc; break;
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, "Usage: bulkflash [-r] [-n] [-k] firmware.bin\n");
+		return 1;
+	}
+
+	std::ifstream file(argv[optind], std::ios::binary);
+	if (!file) {
+		perror(argv[optind]);
+		return 1;
+	}
+	std::vector<unsigned char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	// PROGRAM takes whole blocks, padded as erased flash
+	image.resize((image.size() + VENDOR_BLOCK_SIZE - 1) / VENDOR_BLOCK_SIZE * VENDOR_BLOCK_SIZE, 0xFF);
+
+	try {
+		Bootloader bootloader;
+		VendorInfo info;
+		bootloader.command(VENDOR_INFO, 0, 0);
+		bootloader.read(reinterpret_cast<unsigned char *>(&info), sizeof(info));
+		printf("Upload slot 0x%08x, %u bytes, running 0x%08x\n", info.uploadSlot, info.slotLength, info.activeSlot);
+		if (image.size() > info.slotLength)
+			throw std::runtime_error("the image does not fit in the slot");
+
+		const auto start = std::chrono::steady_clock::now();
+		const uint32_t eraseLength = (image.size() + info.eraseSize - 1) / info.eraseSize * info.eraseSize;
+		timed("Erase", eraseLength, [&] { bootloader.command(VENDOR_ERASE, info.uploadSlot, eraseLength); });
+		timed("Program", image.size(), [&] { bootloader.command(VENDOR_PROGRAM, info.uploadSlot, image.size(), image.data()); });
+		if (checkCrc) {
+			timed("CRC", image.size(), [&] {
+				if (bootloader.command(VENDOR_CRC, info.uploadSlot, image.size()) != crc32(inFlash(image)))
+					throw std::runtime_error("the CRC32 of the flash does not match the file");
+			});
+		}
+		if (readBack) {
+			timed("Read", image.size(), [&] {
+				std::vector<unsigned char> flash(image.size());
+				bootloader.command(VENDOR_READ, info.uploadSlot, flash.size());
+				bootloader.read(flash.data(), flash.size());
+				if (flash != inFlash(image))
+					throw std::runtime_error("the flash does not match the file");
+			});
+		}
+		if (boot)
+			bootloader.command(VENDOR_BOOT, 0, 0);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("Total    %8.1f ms %8.1f KB/s\n", seconds * 1000, image.size() / 1024.0 / seconds);
+	}
+	catch (const std::exception &error) {
+		fprintf(stderr, "bulkflash: %s\n", error.what());
+		return 2;
+	}
+	return 0;
+}
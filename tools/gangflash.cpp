@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Flashes the same image onto every attached bootloader drive at once, one thread per
+// drive, and prints per drive timings and the aggregate throughput. Linux only.
+// Usage: gangflash [-n] [-k] [-c chunk kB] firmware.bin [/dev/sdX...]
+//   Without devices, every drive of a bootloader (VID 1cbe, mass storage or composite
+//   PID) is flashed. The image is written over firmware.bin with O_DIRECT, read back
+//   and compared, then the drive is ejected, which starts the new image. Bootloaders
+//   built with VERIFY=1 are asked for the CRC32 of the upload instead of the read back.
+//   -n skips the verification (NOREAD=1 builds, encrypted files and patches)
+//   -k keeps the bootloader running instead of ejecting
+//   -c sets the size of each write, 64 kB by default
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/cdrom.h>
+
+static const char * const VID = "1cbe";
+static const char * const PIDS[] = { "00fd", "0120" }; // USB_PID_MSC and USB_PID_MSC_COMPOSITE
+static const size_t SECTOR_SIZE = 512;
+static const size_t ALIGNMENT = 4096; // O_DIRECT buffers and lengths
+
+struct Drive {
+	Drive(const std::string &device, const std::string &port) : device(device), port(port) {}
+	std::string device; // /dev/sdX
+	std::string port;   // USB port path, e.g. 1-2.3, to tell the stations apart
+	std::string error;  // Empty if everything went well
+	double writeSeconds = 0, verifySeconds = 0, totalSeconds = 0;
+};
+
+static std::mutex outputMutex;
+
+static std::string readLine(const std::string &path)
+{
+	std::ifstream file(path);
+	std::string line;
+	std::getline(file, line);
+	return line;
+}
+
+// The block devices whose USB device has the bootloader's VID and PID
+static std::vector<Drive> discover()
+{
+	std::vector<Drive> drives;
+	DIR *blocks = opendir("/sys/block");
+	if (!blocks)
+		return drives;
+	while (const dirent *entry = readdir(blocks)) {
+		if (strncmp(entry->d_name, "sd", 2) != 0)
+			continue;
+		char path[PATH_MAX];
+		if (!realpath(("/sys/block/" + std::string(entry->d_name) + "/device").c_str(), path))
+			continue;
+		// Up from the SCSI device to the USB device, the first directory with idVendor
+		for (std::string usb = path; usb.size() > 1; usb.erase(usb.rfind('/'))) {
+			const std::string vendor = readLine(usb + "/idVendor");
+			if (vendor.empty())
+				continue;
+			const std::string product = readLine(usb + "/idProduct");
+			if (vendor == VID && std::find(std::begin(PIDS), std::end(PIDS), product) != std::end(PIDS))
+				drives.push_back(Drive("/dev/" + std::string(entry->d_name), usb.substr(usb.rfind('/') + 1)));
+			break;
+		}
+	}
+	closedir(blocks);
+	std::sort(drives.begin(), drives.end(), [](const Drive &a, const Drive &b) { return a.port < b.port; });
+	return drives;
+}
+
+static double since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// An aligned buffer for O_DIRECT
+struct Buffer {
+	explicit Buffer(size_t size) : data(nullptr), size(size)
+	{
+		void *memory;
+		if (posix_memalign(&memory, ALIGNMENT, size) == 0)
+			data = static_cast<unsigned char *>(memory);
+	}
+	~Buffer() { free(data); }
+	unsigned char *data;
+	size_t size;
+};
+
+static bool transfer(int fd, bool write, unsigned char *data, size_t length, off_t offset, size_t chunk)
+{
+	for (size_t done = 0; done < length; ) {
+		const size_t size = std::min(chunk, length - done);
+		const ssize_t result = write ? pwrite(fd, data + done, size, offset + done) : pread(fd, data + done, size, offset + done);
+		if (result <= 0)
+			return false;
+		done += result;
+	}
+	return true;
+}
+
+// Same as zlib's crc32() and the bootloader's crc32Update()
+static uint32_t crc32(const unsigned char *data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	while (length--) {
+		crc ^= *data++;
+		for (int bit = 0; bit < 8; bit++)
+			crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+// Where firmware.bin starts on the drive, from the boot sector and the root directory.
+// query is set to where VERIFY.TXT is, or to -1 if the bootloader has none.
+static off_t findFirmware(int fd, Buffer &buffer, off_t &query, std::string &error)
+{
+	if (pread(fd, buffer.data, ALIGNMENT, 0) != static_cast<ssize_t>(ALIGNMENT)) {
+		error = "cannot read the boot sector";
+		return -1;
+	}
+	const unsigned char *boot = buffer.data;
+	const unsigned long sectorsPerCluster = boot[13];
+	const unsigned long reserved = boot[14] | boot[15] << 8;
+	const unsigned long fats = boot[16];
+	const unsigned long rootEntries = boot[17] | boot[18] << 8;
+	const unsigned long fatSectors = boot[22] | boot[23] << 8;
+	const unsigned long rootStart = reserved + fats * fatSectors;
+	const unsigned long dataStart = rootStart + rootEntries * 32 / SECTOR_SIZE;
+
+	const off_t rootOffset = rootStart * SECTOR_SIZE / ALIGNMENT * ALIGNMENT;
+	if (pread(fd, buffer.data, ALIGNMENT, rootOffset) != static_cast<ssize_t>(ALIGNMENT)) {
+		error = "cannot read the root directory";
+		return -1;
+	}
+	off_t firmware = -1;
+	query = -1;
+	for (size_t i = rootStart * SECTOR_SIZE - rootOffset; i + 32 <= ALIGNMENT; i += 32) {
+		const unsigned char *entry = buffer.data + i;
+		if (entry[0] == 0)
+			break;
+		const off_t start = (dataStart + ((entry[26] | entry[27] << 8) - 2) * sectorsPerCluster) * SECTOR_SIZE;
+		if ((entry[11] & 0x18) != 0) // A directory or the volume label
+			continue;
+		if (memcmp(entry, "FIRMWARE", 8) == 0)
+			firmware = start;
+		else if (memcmp(entry, "VERIFY  TXT", 11) == 0)
+			query = start;
+	}
+	if (firmware < 0)
+		error = "no firmware file on the drive";
+	return firmware;
+}
+
+// Asks VERIFY.TXT for the CRC32 of the upload slot over the length of the image and
+// compares it with the image's, a few hundred bytes on the bus instead of the image
+static void verifyQuery(int fd, off_t query, const std::vector<unsigned char> &image, Buffer &buffer, std::string &error)
+{
+	char *text = reinterpret_cast<char *>(buffer.data);
+	unsigned long upload, crc;
+	std::fill(buffer.data, buffer.data + SECTOR_SIZE, 0);
+	if (pread(fd, buffer.data, SECTOR_SIZE, query) != static_cast<ssize_t>(SECTOR_SIZE) || sscanf(text, "upload %lx", &upload) != 1) {
+		error = "cannot read VERIFY.TXT";
+		return;
+	}
+	std::fill(buffer.data, buffer.data + SECTOR_SIZE, 0);
+	snprintf(text, SECTOR_SIZE, "crc32 0x%08lx %zu\n", upload, image.size());
+	if (pwrite(fd, buffer.data, SECTOR_SIZE, query) != static_cast<ssize_t>(SECTOR_SIZE)) {
+		error = std::string("query failed: ") + strerror(errno);
+		return;
+	}
+	// The bootloader programs what is still queued first, then computes the CRC
+	for (int tries = 0; tries < 5000; tries++) {
+		std::fill(buffer.data, buffer.data + SECTOR_SIZE, 0);
+		if (pread(fd, buffer.data, SECTOR_SIZE, query) != static_cast<ssize_t>(SECTOR_SIZE)) {
+			error = std::string("query failed: ") + strerror(errno);
+			return;
+		}
+		const char *answer = strchr(text, '\n');
+		if (answer && strncmp(answer + 1, "busy", 4) != 0) {
+			if (sscanf(answer + 1, "crc32 %*s %*s %lx", &crc) != 1)
+				error = std::string("query failed: ") + std::string(answer + 1, strcspn(answer + 1, "\n"));
+			else if (crc != crc32(image.data(), image.size()))
+				error = "CRC32 of the upload differs from the image";
+			return;
+		}
+		usleep(1000);
+	}
+	error = "no answer from VERIFY.TXT";
+}
+
+static void flash(Drive &drive, const std::vector<unsigned char> &image, bool verify, bool eject, size_t chunk)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const int fd = open(drive.device.c_str(), O_RDWR | O_DIRECT | O_SYNC);
+	if (fd < 0) {
+		drive.error = std::string("cannot open: ") + strerror(errno);
+		return;
+	}
+
+	const size_t length = (image.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	Buffer buffer(std::max(length, ALIGNMENT));
+	off_t query = -1;
+	const off_t offset = buffer.data ? findFirmware(fd, buffer, query, drive.error) : -1;
+	if (!buffer.data)
+		drive.error = "out of memory";
+	if (offset >= 0) {
+		// Padded as erased flash, the bootloader programs whole blocks anyway
+		std::fill(std::copy(image.begin(), image.end(), buffer.data), buffer.data + length, 0xFF);
+		auto step = std::chrono::steady_clock::now();
+		if (!transfer(fd, true, buffer.data, length, offset, chunk))
+			drive.error = std::string("write failed: ") + strerror(errno);
+		drive.writeSeconds = since(step);
+
+		if (drive.error.empty() && verify) {
+			step = std::chrono::steady_clock::now();
+			if (query >= 0) {
+				verifyQuery(fd, query, image, buffer, drive.error);
+			}
+			else {
+				std::fill(buffer.data, buffer.data + length, 0);
+				if (!transfer(fd, false, buffer.data, length, offset, chunk))
+					drive.error = std::string("read back failed: ") + strerror(errno);
+				else if (!std::equal(image.begin(), image.end(), buffer.data))
+					drive.error = "read back differs from the image";
+			}
+			drive.verifySeconds = since(step);
+		}
+		// The bootloader checks and starts the image when the drive is ejected. It
+		// disconnects right away, so the eject may report an error
+		if (drive.error.empty() && eject)
+			ioctl(fd, CDROMEJECT);
+	}
+	close(fd);
+	drive.totalSeconds = since(start);
+
+	std::lock_guard<std::mutex> lock(outputMutex);
+	printf("%-10s %-8s %s\n", drive.device.c_str(), drive.port.c_str(), drive.error.empty() ? "done" : drive.error.c_str());
+}
+
+int main(int argc, char **argv)
+{
+	bool verify = true, eject = true;
+	size_t chunk = 64 * 1024;
+	int option;
+	while ((option = getopt(argc, argv, "nkc:")) != -1) {
+		switch (option) {
+		case 'n': verify = false; break;
+		case 'k': eject = false; break;
+		case 'c': chunk = std::max<size_t>(atoi(optarg), 4) * 1024 / ALIGNMENT * ALIGNMENT; break;
+		default: optind = argc; break;
+		}
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: gangflash [-n] [-k] [-c chunk kB] firmware.bin [/dev/sdX...]\n");
+		return 1;
+	}
+
+	std::ifstream file(argv[optind], std::ios::binary);
+	if (!file) {
+		perror(argv[optind]);
+		return 1;
+	}
+	const std::vector<unsigned char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	std::vector<Drive> drives;
+	for (int i = optind + 1; i < argc; i++)
+		drives.push_back(Drive(argv[i], "-"));
+	if (drives.empty())
+		drives = discover();
+	if (drives.empty()) {
+		fprintf(stderr, "No bootloader drives found\n");
+		return 1;
+	}
+	printf("Flashing %zu bytes onto %zu drives\n", image.size(), drives.size());
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (Drive &drive : drives)
+		threads.emplace_back(flash, std::ref(drive), std::cref(image), verify, eject, chunk);
+	for (std::thread &thread : threads)
+		thread.join();
+	const double seconds = since(start);
+
+	printf("\n%-10s %-8s %10s %10s %10s %10s\n", "Drive", "Port", "Write ms", "Write kB/s", "Verify ms", "Total ms");
+	unsigned int failed = 0;
+	for (const Drive &drive : drives) {
+		printf("%-10s %-8s %10.1f %10.1f %10.1f %10.1f%s\n", drive.device.c_str(), drive.port.c_str(),
+		       drive.writeSeconds * 1000, drive.writeSeconds ? image.size() / 1024.0 / drive.writeSeconds : 0.0,
+		       drive.verifySeconds * 1000, drive.totalSeconds * 1000, drive.error.empty() ? "" : "  FAILED");
+		failed += !drive.error.empty();
+	}
+	printf("\n%zu of %zu drives flashed in %.1f ms, %.1f kB/s aggregate\n", drives.size() - failed, drives.size(),
+	       seconds * 1000, (drives.size() - failed) * image.size() / 1024.0 / seconds);
+	return failed ? 2 : 0;
+}
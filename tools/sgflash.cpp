@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Writes firmware onto a bootloader drive with SCSI commands (SG_IO), without mounting
+// it, so that neither the page cache nor the FAT driver decides the order and size of
+// the writes. Linux only.
+// Usage: sgflash [-k] [-m blocks] firmware.bin /dev/sdX
+//   The image goes straight into the clusters of firmware.bin, in WRITE(10) commands as
+//   large as the device takes. Then the FAT and the directory entry are patched to the
+//   size of the image and the drive is ejected with START STOP UNIT, which starts it.
+//   -k keeps the bootloader running instead of ejecting
+//   -m limits the blocks per WRITE(10), by default the kernel's limit for the device
+//   Devices without SG_IO (loop devices, image files) are written with pwrite instead.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <scsi/sg.h>
+
+static const size_t DISK_BLOCK = 512;
+static const unsigned int TIMEOUT = 30000; // ms, the first block waits for the slot to be erased
+
+static double since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The drive as 512 byte blocks, through SG_IO or plain reads and writes
+class Disk {
+public:
+	explicit Disk(const char *path)
+	{
+		fd = open(path, O_RDWR | O_EXCL);
+		if (fd < 0)
+			throw std::runtime_error(std::string(path) + ": " + strerror(errno));
+
+		// READ CAPACITY(10) tells whether SG_IO works and checks the block size
+		unsigned char command[10] = { 0x25 };
+		unsigned char capacity[8];
+		scsi = true;
+		if (!scsiCommand(command, sizeof(command), SG_DXFER_FROM_DEV, capacity, sizeof(capacity), false)) {
+			scsi = false;
+		}
+		else if ((capacity[4] << 24 | capacity[5] << 16 | capacity[6] << 8 | capacity[7]) != DISK_BLOCK) {
+			throw std::runtime_error("the device does not have 512 byte blocks");
+		}
+
+		// The kernel's limit per request for a disk, a guess for an sg node, none for a file
+		int sectors = 0;
+		if (ioctl(fd, BLKSECTGET, &sectors) == 0 && sectors > 0)
+			maxBlocks = std::min(sectors, 0xFFFF);
+		else
+			maxBlocks = scsi ? 128 : 0xFFFF;
+	}
+
+	~Disk()
+	{
+		close(fd);
+	}
+
+	void read(uint32_t block, uint32_t count, unsigned char *data)
+	{
+		transfer(0x28, block, count, data);
+	}
+
+	void write(uint32_t block, uint32_t count, const unsigned char *data)
+	{
+		transfer(0x2A, block, count, const_cast<unsigned char *>(data));
+	}
+
+	// START STOP UNIT with LoEj, the bootloader checks and starts the new image
+	void eject()
+	{
+		unsigned char command[6] = { 0x1B, 0, 0, 0, 0x02, 0 };
+		if (scsi)
+			scsiCommand(command, sizeof(command), SG_DXFER_NONE, nullptr, 0, false);
+		else
+			fsync(fd);
+	}
+
+	bool scsi;              // SG_IO works, otherwise pread and pwrite
+	unsigned int maxBlocks; // Per command
+	unsigned long commands = 0;
+
+private:
+	// READ(10) or WRITE(10), split into commands of at most maxBlocks
+	void transfer(uint8_t opcode, uint32_t block, uint32_t count, unsigned char *data)
+	{
+		while (count) {
+			const uint32_t blocks = std::min(count, maxBlocks);
+			if (scsi) {
+				unsigned char command[10] = { opcode, 0,
+					uint8_t(block >> 24), uint8_t(block >> 16), uint8_t(block >> 8), uint8_t(block), 0,
+					uint8_t(blocks >> 8), uint8_t(blocks), 0 };
+				scsiCommand(command, sizeof(command), opcode == 0x28 ? SG_DXFER_FROM_DEV : SG_DXFER_TO_DEV, data, blocks * DISK_BLOCK, true);
+			}
+			else {
+				const ssize_t size = blocks * DISK_BLOCK;
+				const off_t offset = off_t(block) * DISK_BLOCK;
+				if ((opcode == 0x28 ? pread(fd, data, size, offset) : pwrite(fd, data, size, offset)) != size)
+					throw std::runtime_error(std::string(opcode == 0x28 ? "read" : "write") + " failed: " + strerror(errno));
+			}
+			commands++;
+			block += blocks;
+			count -= blocks;
+			data += blocks * DISK_BLOCK;
+		}
+	}
+
+	// Returns false if the device does not take SG_IO, throws if it takes it but the command failed
+	bool scsiCommand(unsigned char *command, size_t length, int direction, unsigned char *data, size_t size, bool required)
+	{
+		unsigned char sense[32];
+		sg_io_hdr_t header;
+		memset(&header, 0, sizeof(header));
+		header.interface_id = 'S';
+		header.dxfer_direction = direction;
+		header.cmd_len = length;
+		header.mx_sb_len = sizeof(sense);
+		header.dxfer_len = size;
+		header.dxferp = data;
+		header.cmdp = command;
+		header.sbp = sense;
+		header.timeout = TIMEOUT;
+		if (ioctl(fd, SG_IO, &header) < 0) {
+			if (!required && (errno == ENOTTY || errno == EINVAL))
+				return false;
+			throw std::runtime_error(std::string("SG_IO: ") + strerror(errno));
+		}
+		if ((header.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
+			char error[64];
+			snprintf(error, sizeof(error), "SCSI command %02x failed, status %02x, sense key %x",
+			         command[0], header.status, header.sb_len_wr > 2 ? sense[2] & 0x0F : 0);
+			throw std::runtime_error(error);
+		}
+		return true;
+	}
+
+	int fd;
+};
+
+static unsigned int fatEntry(const std::vector<unsigned char> &fat, unsigned long cluster)
+{
+	const unsigned char *entry = &fat[cluster * 3 / 2];
+	return cluster & 1 ? (entry[0] >> 4 | entry[1] << 4) : (entry[0] | (entry[1] & 0x0F) << 8);
+}
+
+static void setFatEntry(std::vector<unsigned char> &fat, unsigned long cluster, unsigned int value)
+{
+	unsigned char *entry = &fat[cluster * 3 / 2];
+	if (cluster & 1) {
+		entry[0] = (entry[0] & 0x0F) | (value << 4 & 0xF0);
+		entry[1] = value >> 4;
+	}
+	else {
+		entry[0] = value;
+		entry[1] = (entry[1] & 0xF0) | (value >> 8 & 0x0F);
+	}
+}
+
+// A metadata write as a trace line for sim/trace-replay
+static void traceWrite(FILE *trace, unsigned long block, unsigned long count, const unsigned char *data)
+{
+	size_t length = count * DISK_BLOCK;
+	while (length && !data[length - 1])
+		length--;
+	fprintf(trace, "W %lu %lu hex:", block, count);
+	for (size_t i = 0; i < length; i++)
+		fprintf(trace, "%02x", data[i]);
+	fprintf(trace, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	bool eject = true;
+	unsigned int maxBlocks = 0;
+	FILE *trace = nullptr;
+	int option;
+	while ((option = getopt(argc, argv, "km:t:")) != -1) {
+		switch (option) {
+		case 'k': eject = false; break;
+		case 'm': maxBlocks = atoi(optarg); break;
+		case 't':
+			trace = fopen(optarg, "w");
+			if (!trace) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default: optind = argc; break;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "Usage: sgflash [-k] [-m blocks] [-t trace] firmware.bin /dev/sdX\n");
+		return 1;
+	}
+
+	std::ifstream file(argv[optind], std::ios::binary);
+	if (!file) {
+		perror(argv[optind]);
+		return 1;
+	}
+	std::vector<unsigned char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	const size_t length = image.size();
+	// Whole blocks, padded as erased flash
+	image.resize((length + DISK_BLOCK - 1) / DISK_BLOCK * DISK_BLOCK, 0xFF);
+	const unsigned long imageBlocks = image.size() / DISK_BLOCK;
+
+	try {
+		const auto start = std::chrono::steady_clock::now();
+		Disk disk(argv[optind + 1]);
+		if (maxBlocks)
+			disk.maxBlocks = std::min(maxBlocks, disk.maxBlocks);
+		if (trace)
+			fprintf(trace, "# sgflash -m %u %s (%zu bytes)\n", disk.maxBlocks, argv[optind], length);
+
+		// The layout from the boot sector, as any host takes it
+		unsigned char boot[DISK_BLOCK];
+		disk.read(0, 1, boot);
+		const unsigned long sectorsPerCluster = boot[13];
+		const unsigned long reserved = boot[14] | boot[15] << 8;
+		const unsigned long fats = boot[16];
+		const unsigned long rootEntries = boot[17] | boot[18] << 8;
+		const unsigned long totalSectors = boot[19] | boot[20] << 8;
+		const unsigned long fatSectors = boot[22] | boot[23] << 8;
+		const unsigned long rootStart = reserved + fats * fatSectors;
+		const unsigned long rootSectors = rootEntries * 32 / DISK_BLOCK;
+		const unsigned long dataStart = rootStart + rootSectors;
+		if (boot[510] != 0x55 || boot[511] != 0xAA || !sectorsPerCluster || !fats || !fatSectors || totalSectors <= dataStart)
+			throw std::runtime_error("no FAT12 file system on the device");
+		const unsigned long clusterCount = (totalSectors - dataStart) / sectorsPerCluster;
+
+		std::vector<unsigned char> fat(fatSectors * DISK_BLOCK);
+		disk.read(reserved, fatSectors, fat.data());
+		std::vector<unsigned char> root(rootSectors * DISK_BLOCK);
+		disk.read(rootStart, rootSectors, root.data());
+		if (trace)
+			fprintf(trace, "R 0 1\nR %lu %lu\nR %lu %lu\n", reserved, fatSectors, rootStart, rootSectors);
+
+		// The firmware file, FIRMWARE.BIN or FIRMWARE.SIG with CRYPTO=1
+		size_t entry = 0;
+		while (entry < root.size() && !(memcmp(&root[entry], "FIRMWARE", 8) == 0 && (root[entry + 11] & 0x18) == 0))
+			entry += 32;
+		if (entry == root.size())
+			throw std::runtime_error("no firmware file on the drive");
+
+		// The image takes consecutive clusters from the file's first one on, which is where
+		// the bootloader expects it, whatever chain the FAT has for it now
+		const unsigned long firstCluster = root[entry + 26] | root[entry + 27] << 8;
+		const unsigned long clusters = (imageBlocks + sectorsPerCluster - 1) / sectorsPerCluster;
+		if (firstCluster < 2 || firstCluster + clusters > clusterCount + 2)
+			throw std::runtime_error("the image does not fit behind the firmware file's first cluster");
+
+		// The FAT first: the bootloader follows the chain to place the data, and the chain it
+		// has now may end early. The old chain's clusters past the image are freed.
+		auto step = std::chrono::steady_clock::now();
+		std::vector<unsigned long> oldChain;
+		for (unsigned long cluster = firstCluster; cluster >= 2 && cluster < clusterCount + 2 && oldChain.size() < clusterCount; cluster = fatEntry(fat, cluster))
+			oldChain.push_back(cluster);
+		for (unsigned long cluster : oldChain)
+			setFatEntry(fat, cluster, 0);
+		for (unsigned long i = 0; i < clusters; i++)
+			setFatEntry(fat, firstCluster + i, i + 1 < clusters ? firstCluster + i + 1 : 0xFFF);
+		for (unsigned long i = 0; i < fats; i++) {
+			disk.write(reserved + i * fatSectors, fatSectors, fat.data());
+			if (trace)
+				traceWrite(trace, reserved + i * fatSectors, fatSectors, fat.data());
+		}
+		double metadataSeconds = since(step);
+
+		// The data in file order, in commands as large as the device takes
+		step = std::chrono::steady_clock::now();
+		const unsigned long before = disk.commands;
+		const unsigned long firstBlock = dataStart + (firstCluster - 2) * sectorsPerCluster;
+		for (unsigned long block = 0; block < imageBlocks; block += disk.maxBlocks) {
+			const unsigned long count = std::min<unsigned long>(disk.maxBlocks, imageBlocks - block);
+			disk.write(firstBlock + block, count, image.data() + block * DISK_BLOCK);
+			if (trace) {
+				fprintf(trace, "W %lu %lu image:%lu", firstBlock + block, count, block);
+				if ((block + count) * DISK_BLOCK > length)
+					fprintf(trace, ",%lu", length - block * DISK_BLOCK);
+				fprintf(trace, "\n");
+			}
+		}
+		const double dataSeconds = since(step);
+		const unsigned long dataCommands = disk.commands - before;
+
+		// The directory entry last, its size tells the bootloader where the image ends
+		step = std::chrono::steady_clock::now();
+		for (int i = 0; i < 4; i++)
+			root[entry + 28 + i] = length >> (8 * i);
+		const unsigned long entryBlock = entry / DISK_BLOCK;
+		disk.write(rootStart + entryBlock, 1, &root[entryBlock * DISK_BLOCK]);
+		if (trace)
+			traceWrite(trace, rootStart + entryBlock, 1, &root[entryBlock * DISK_BLOCK]);
+		metadataSeconds += since(step);
+
+		if (eject) {
+			disk.eject();
+			if (trace)
+				fprintf(trace, "E\n");
+		}
+		if (trace)
+			fclose(trace);
+
+		printf("%zu bytes to cluster %lu in %lu %s commands of up to %u blocks\n", length, firstCluster,
+		       dataCommands, disk.scsi ? "WRITE(10)" : "pwrite", disk.maxBlocks);
+		printf("Data      %8.1f ms %8.1f kB/s\n", dataSeconds * 1000, length / 1024.0 / dataSeconds);
+		printf("FAT, dir  %8.1f ms\n", metadataSeconds * 1000);
+		printf("Total     %8.1f ms%s\n", since(start) * 1000, eject ? ", ejected" : "");
+	}
+	catch (const std::exception &error) {
+		fprintf(stderr, "sgflash: %s\n", error.what());
+		return 2;
+	}
+	return 0;
+}
@@ -30,10 +30,18 @@
 #include "usblib/usblib.h"
 #include "usblib/usb-ids.h"
 #include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdcomp.h"
 #include "usblib/device/usbdmsc.h"
 #include "usb_config.h"
 #include "ramdisk.h"
 
+#ifdef DFU
+#include "usb_dfu.h"
+#endif
+#ifdef VENDOR
+#include "usb_vendor.h"
+#endif
+
 const uint8_t g_pui8LangDescriptor[] = {
 	4,         // Descriptor length
 	USB_DTYPE_STRING,      // Descriptor type - String
@@ -110,3 +118,83 @@ tUSBDMSCDevice massStorageDevice =
 	},
 	.pfnEventCallback = massStorageEventCallback
 };
+
+#ifdef CONSOLE
+tUSBDCDCDevice consoleDevice =
+{
+	.ui16VID = USB_VID_TI_1CBE,
+	.ui16PID = USB_PID_SERIAL,
+	.ui16MaxPowermA = 500,
+	.ui8PwrAttributes = USB_CONF_ATTR_SELF_PWR,
+	.pfnControlCallback = consoleControlCallback,
+	.pvControlCBData = &consoleDevice,
+	.pfnRxCallback = USBBufferEventCallback,
+	.pvRxCBData = &consoleRxBuffer,
+	.pfnTxCallback = USBBufferEventCallback,
+	.pvTxCBData = &consoleTxBuffer,
+	.ppui8StringDescriptors = g_ppui8StringDescriptors,
+	.ui32NumStringDescriptors = NUM_STRING_DESCRIPTORS,
+};
+#endif
+
+#ifdef USB_COMPOSITE
+enum compositeEntry_e {
+	COMPOSITE_MSC,
+#ifdef DFU
+	COMPOSITE_DFU,
+#endif
+#ifdef VENDOR
+	COMPOSITE_VENDOR,
+#endif
+#ifdef CONSOLE
+	COMPOSITE_CONSOLE,
+#endif
+	COMPOSITE_ENTRIES
+};
+
+#ifndef DFU
+#define DFU_DESCRIPTOR_SIZE 0
+#endif
+#ifndef VENDOR
+#define VENDOR_DESCRIPTOR_SIZE 0
+#endif
+#ifndef CONSOLE
+#define CONSOLE_DESCRIPTOR_SIZE 0
+#endif
+#define COMPOSITE_DESCRIPTOR_SIZE (9 + COMPOSITE_DMSC_SIZE + DFU_DESCRIPTOR_SIZE + VENDOR_DESCRIPTOR_SIZE + CONSOLE_DESCRIPTOR_SIZE)
+
+static tCompositeEntry compositeEntries[COMPOSITE_ENTRIES];
+static uint8_t compositeDescriptor[COMPOSITE_DESCRIPTOR_SIZE];
+
+tUSBDCompositeDevice compositeDevice =
+{
+	.ui16VID = USB_VID_TI_1CBE,
+	.ui16PID = USB_PID_MSC_COMPOSITE,
+	.ui16MaxPowermA = 500,
+	.ui8PwrAttributes = USB_CONF_ATTR_SELF_PWR,
+	.pfnCallback = massStorageEventCallback,
+	.ppui8StringDescriptors = g_ppui8StringDescriptors,
+	.ui32NumStringDescriptors = NUM_STRING_DESCRIPTORS,
+	.ui32NumDevices = COMPOSITE_ENTRIES,
+	.psDevices = compositeEntries
+};
+#endif
+
+void usbDeviceInit(void)
+{
+#ifdef USB_COMPOSITE
+	USBDMSCCompositeInit(0, &massStorageDevice, &compositeEntries[COMPOSITE_MSC]);
+#ifdef DFU
+	dfuCompositeInit(&compositeEntries[COMPOSITE_DFU]);
+#endif
+#ifdef VENDOR
+	vendorCompositeInit(&compositeEntries[COMPOSITE_VENDOR]);
+#endif
+#ifdef CONSOLE
+	consoleCompositeInit(&compositeEntries[COMPOSITE_CONSOLE]);
+#endif
+	USBDCompositeInit(0, &compositeDevice, sizeof(compositeDescriptor), compositeDescriptor);
+#else
+	USBDMSCInit(0, &massStorageDevice);
+#endif
+}
@@ -25,7 +25,28 @@
 #ifndef __USB_CONFIG_H__
 #define __USB_CONFIG_H__
 
+// Mass storage only, or a composite device with the optional interfaces
+#if defined(DFU) || defined(VENDOR) || defined(CONSOLE)
+#define USB_COMPOSITE
+// Not assigned by TI, a product needs its own VID and PID
+#define USB_PID_MSC_COMPOSITE 0x0120
+#endif
+
 extern tUSBDMSCDevice massStorageDevice;
+#ifdef CONSOLE
+// The serial console in console.c, on usblib's CDC class driver and USB buffers
+#include "usblib/device/usbdcdc.h"
+#define CONSOLE_DESCRIPTOR_SIZE (COMPOSITE_DCDC_SIZE)
+extern tUSBDCDCDevice consoleDevice;
+extern tUSBBuffer consoleRxBuffer;
+extern tUSBBuffer consoleTxBuffer;
+extern uint32_t consoleControlCallback(void *callbackData, uint32_t event, uint32_t messageValue, void *messageData);
+// Sets up the buffers and fills the entry for USBDCompositeInit
+extern void *consoleCompositeInit(tCompositeEntry *compositeEntry);
+#endif
 extern uint32_t massStorageEventCallback(void* callback, unsigned long event, unsigned long messageParameters, void* messageData);
 
+// Passes the device information to the USB library and places the device on the bus
+extern void usbDeviceInit(void);
+
 #endif
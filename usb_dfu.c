@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "inc/hw_flash.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "driverlib/usb.h"
+#include "usblib/usblib.h"
+#include "usblib/usb-ids.h"
+#include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdcomp.h"
+
+#include "usb_dfu.h"
+#include "bootctl.h"
+#include "common.h"
+#include "ramdisk.h"
+
+#ifdef DEBUGPRINT
+#include "console.h"
+#endif
+
+// Class requests, DFU 1.1 section 3
+#define DFU_DETACH    0
+#define DFU_DNLOAD    1
+#define DFU_UPLOAD    2
+#define DFU_GETSTATUS 3
+#define DFU_CLRSTATUS 4
+#define DFU_GETSTATE  5
+#define DFU_ABORT     6
+
+// States and status codes, DFU 1.1 section 6.1.2
+enum dfuState_e {
+	DFU_STATE_IDLE = 2,
+	DFU_STATE_DNLOAD_SYNC = 3,
+	DFU_STATE_DNBUSY = 4,
+	DFU_STATE_DNLOAD_IDLE = 5,
+	DFU_STATE_MANIFEST_SYNC = 6,
+	DFU_STATE_MANIFEST = 7,
+	DFU_STATE_MANIFEST_WAIT_RESET = 8,
+	DFU_STATE_UPLOAD_IDLE = 9,
+	DFU_STATE_ERROR = 10,
+};
+
+enum dfuStatus_e {
+	DFU_STATUS_OK = 0x00,
+	DFU_STATUS_ERR_FILE = 0x02,
+	DFU_STATUS_ERR_WRITE = 0x03,
+	DFU_STATUS_ERR_ADDRESS = 0x08,
+	DFU_STATUS_ERR_NOTDONE = 0x09,
+	DFU_STATUS_ERR_STALLEDPKT = 0x0F,
+};
+
+#define DFU_ATTR_CAN_DNLOAD  0x01
+#define DFU_ATTR_CAN_UPLOAD  0x02
+#define DFU_ATTR_WILL_DETACH 0x08
+
+// While the write queue is full the host waits this many ms before it asks again. With the
+// status request itself that is about what programming a block takes, while a page is
+// erased the host just asks a few more times.
+#define DFU_BUSY_TIMEOUT (2)
+
+static struct {
+	uint8_t state;
+	uint8_t status;
+	uint16_t blockNumber;   // Of the download in progress
+	uint16_t length;        // Bytes in buffer
+	uint8_t reply[6];       // DFU_GETSTATUS
+	unsigned char buffer[DFU_TRANSFER_SIZE] __attribute__ ((aligned(4)));
+} dfu = { .state = DFU_STATE_IDLE };
+
+static const uint8_t dfuDeviceDescriptor[] = {
+	18,                         // Size of this structure
+	USB_DTYPE_DEVICE,           // Type of this structure
+	USBShort(0x110),            // USB version 1.1
+	0, 0, 0,                    // Class, subclass and protocol are given by the interface
+	64,                         // Maximum packet size of endpoint 0
+	USBShort(USB_VID_TI_1CBE),  // Replaced by the composite device's
+	USBShort(USB_PID_DFU),
+	USBShort(0x0100),           // Device release number
+	1, 2, 3,                    // Manufacturer, product and serial number strings
+	1,                          // One configuration
+};
+
+static const uint8_t dfuConfigDescriptor[] = {
+	9,                          // Size of the config descriptor
+	USB_DTYPE_CONFIGURATION,    // Type of this descriptor
+	USBShort(9 + DFU_DESCRIPTOR_SIZE), // Total size of the configuration
+	1,                          // One interface
+	1,                          // Configuration value
+	0,                          // No string
+	USB_CONF_ATTR_SELF_PWR,
+	250,                        // 500 mA
+};
+
+static const uint8_t dfuInterface[DFU_DESCRIPTOR_SIZE] = {
+	// Interface descriptor, the number is set by the composite device
+	9,                          // Size of the interface descriptor
+	USB_DTYPE_INTERFACE,        // Type of this descriptor
+	0,                          // Interface number
+	0,                          // Alternate setting
+	0,                          // Only endpoint 0
+	USB_CLASS_APP_SPECIFIC,     // Application specific class
+	0x01,                       // Device Firmware Upgrade
+	0x02,                       // DFU mode
+	0,                          // No string
+
+	// DFU functional descriptor
+	9,                          // Size of the functional descriptor
+	0x21,                       // DFU FUNCTIONAL
+#ifdef NOREAD
+	DFU_ATTR_CAN_DNLOAD | DFU_ATTR_WILL_DETACH,
+#else
+	DFU_ATTR_CAN_DNLOAD | DFU_ATTR_CAN_UPLOAD | DFU_ATTR_WILL_DETACH,
+#endif
+	USBShort(1000),             // Detach timeout in ms, unused in DFU mode
+	USBShort(DFU_TRANSFER_SIZE),
+	USBShort(0x0110),           // DFU 1.1
+};
+
+static const tConfigSection dfuConfigSection = { sizeof(dfuConfigDescriptor), dfuConfigDescriptor };
+static const tConfigSection dfuInterfaceSection = { sizeof(dfuInterface), dfuInterface };
+static const tConfigSection * const dfuSections[] = { &dfuConfigSection, &dfuInterfaceSection };
+static const tConfigHeader dfuConfigHeader = { sizeof(dfuSections) / sizeof(dfuSections[0]), dfuSections };
+static const tConfigHeader * const dfuConfigDescriptors[] = { &dfuConfigHeader };
+
+static void dfuError(uint8_t status)
+{
+	dfu.state = DFU_STATE_ERROR;
+	dfu.status = status;
+}
+
+static void dfuGetStatus(uint16_t length)
+{
+	uint32_t pollTimeout = 0;
+
+	switch (dfu.state) {
+	case DFU_STATE_DNLOAD_SYNC:
+	case DFU_STATE_DNBUSY:
+		// The block is queued already, the next one is only asked for once there is room
+		if (uploadBusy()) {
+			dfu.state = DFU_STATE_DNBUSY;
+			pollTimeout = DFU_BUSY_TIMEOUT;
+		}
+		else {
+			dfu.state = DFU_STATE_DNLOAD_IDLE;
+		}
+		break;
+	case DFU_STATE_MANIFEST_SYNC:
+		dfu.state = DFU_STATE_MANIFEST;
+		break;
+	case DFU_STATE_MANIFEST:
+		// Not manifestation tolerant: detach once this status is out, see dfuDataSent
+		dfu.state = DFU_STATE_MANIFEST_WAIT_RESET;
+		break;
+	}
+
+	dfu.reply[0] = dfu.status;
+	dfu.reply[1] = pollTimeout & 0xFF;
+	dfu.reply[2] = (pollTimeout >> 8) & 0xFF;
+	dfu.reply[3] = (pollTimeout >> 16) & 0xFF;
+	dfu.reply[4] = dfu.state;
+	dfu.reply[5] = 0;
+	USBDevEndpointDataAck(USB0_BASE, USB_EP_0, false);
+	USBDCDSendDataEP0(0, dfu.reply, length < sizeof(dfu.reply) ? length : sizeof(dfu.reply));
+}
+
+static void dfuRequest(void *instance, tUSBRequest *request)
+{
+	if ((request->bmRequestType & USB_RTYPE_TYPE_M) != USB_RTYPE_CLASS) {
+		USBDCDStallEP0(0);
+		return;
+	}
+
+	switch (request->bRequest) {
+	case DFU_DNLOAD:
+		if ((dfu.state != DFU_STATE_IDLE && dfu.state != DFU_STATE_DNLOAD_IDLE) || request->wLength > DFU_TRANSFER_SIZE)
+			break;
+		if (request->wLength == 0) {
+			// The end of the download, or an empty one
+			if (dfu.state != DFU_STATE_DNLOAD_IDLE)
+				break;
+			dfu.state = DFU_STATE_MANIFEST_SYNC;
+			USBDevEndpointDataAck(USB0_BASE, USB_EP_0, true);
+			return;
+		}
+		dfu.blockNumber = request->wValue;
+		dfu.length = request->wLength;
+		USBDevEndpointDataAck(USB0_BASE, USB_EP_0, false);
+		USBDCDRequestDataEP0(0, dfu.buffer, request->wLength);
+		return;
+
+#ifndef NOREAD
+	case DFU_UPLOAD: {
+		// Reads the active image, a short reply ends the upload
+		const unsigned long offset = (unsigned long)request->wValue * DFU_TRANSFER_SIZE;
+		unsigned long length = request->wLength < DFU_TRANSFER_SIZE ? request->wLength : DFU_TRANSFER_SIZE;
+		if ((dfu.state != DFU_STATE_IDLE && dfu.state != DFU_STATE_UPLOAD_IDLE) || offset > SLOT_LENGTH)
+			break;
+		if (length > SLOT_LENGTH - offset)
+			length = SLOT_LENGTH - offset;
+		dfu.state = length < request->wLength ? DFU_STATE_IDLE : DFU_STATE_UPLOAD_IDLE;
+		USBDevEndpointDataAck(USB0_BASE, USB_EP_0, false);
+		USBDCDSendDataEP0(0, (uint8_t *)(activeSlot() + offset), length);
+		return;
+	}
+#endif
+
+	case DFU_GETSTATUS:
+		dfuGetStatus(request->wLength);
+		return;
+
+	case DFU_CLRSTATUS:
+		if (dfu.state != DFU_STATE_ERROR)
+			break;
+		dfu.state = DFU_STATE_IDLE;
+		dfu.status = DFU_STATUS_OK;
+		USBDevEndpointDataAck(USB0_BASE, USB_EP_0, true);
+		return;
+
+	case DFU_GETSTATE:
+		USBDevEndpointDataAck(USB0_BASE, USB_EP_0, false);
+		USBDCDSendDataEP0(0, &dfu.state, 1);
+		return;
+
+	case DFU_ABORT:
+		// Whatever has been programmed stays, the image check refuses an incomplete image
+		if (dfu.state != DFU_STATE_IDLE && dfu.state != DFU_STATE_DNLOAD_IDLE && dfu.state != DFU_STATE_UPLOAD_IDLE)
+			break;
+		dfu.state = DFU_STATE_IDLE;
+		USBDevEndpointDataAck(USB0_BASE, USB_EP_0, true);
+		return;
+	}
+
+	// Not allowed in this state
+	dfuError(DFU_STATUS_ERR_STALLEDPKT);
+	USBDCDStallEP0(0);
+}
+
+// The data of a DFU_DNLOAD has arrived
+static void dfuDataReceived(void *instance, uint32_t info)
+{
+	const unsigned long offset = (unsigned long)dfu.blockNumber * DFU_TRANSFER_SIZE;
+
+	// The last block is short, the rest of the queue block stays erased
+	for (int i = dfu.length; i < DFU_TRANSFER_SIZE; i++)
+		dfu.buffer[i] = 0xFF;
+
+	if (offset == 0) {
+		if (!isFirmwareStart(dfu.buffer)) {
+			dfuError(DFU_STATUS_ERR_FILE);
+			return;
+		}
+		uploadBegin(dfu.buffer);
+	}
+	else if (dfu.state == DFU_STATE_IDLE) {
+		// A download has to start with block 0, which starts the upload
+		dfuError(DFU_STATUS_ERR_NOTDONE);
+		return;
+	}
+	if (offset + DFU_TRANSFER_SIZE > SLOT_LENGTH) {
+		dfuError(DFU_STATUS_ERR_ADDRESS);
+		return;
+	}
+	// The queue cannot be full here, dfuGetStatus keeps the host busy while it is
+	if (!uploadBlock(offset, dfu.buffer)) {
+		dfuError(DFU_STATUS_ERR_WRITE);
+		return;
+	}
+	dfu.state = DFU_STATE_DNLOAD_SYNC;
+}
+
+static void dfuDataSent(void *instance, uint32_t info)
+{
+	if (dfu.state == DFU_STATE_MANIFEST_WAIT_RESET) {
+#ifdef DEBUGPRINT
+		consolePrintf("DFU download complete\n");
+#endif
+		// Programs what is still queued, then detaches and starts the image
+		uploadEnd();
+	}
+}
+
+static const tCustomHandlers dfuHandlers = {
+	.pfnRequestHandler = dfuRequest,
+	.pfnDataReceived = dfuDataReceived,
+	.pfnDataSent = dfuDataSent,
+};
+
+static tDeviceInfo dfuDeviceInfo = {
+	.psCallbacks = &dfuHandlers,
+	.pui8DeviceDescriptor = dfuDeviceDescriptor,
+	.ppsConfigDescriptors = dfuConfigDescriptors,
+};
+
+void *dfuCompositeInit(tCompositeEntry *compositeEntry)
+{
+	compositeEntry->psDevInfo = &dfuDeviceInfo;
+	compositeEntry->pvInstance = &dfu;
+	return &dfu;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef __USB_DFU_H__
+#define __USB_DFU_H__
+
+// A DFU 1.1 interface in DFU mode next to the mass storage interface, see README.md.
+// Downloads go through the same write queue as files copied onto the drive.
+
+// One block of the write queue per DFU_DNLOAD, so every request fills exactly one
+// queue entry and the USB interrupt NAKs the next request while the queue is full
+#define DFU_TRANSFER_SIZE (BLOCK_SIZE)
+#define DFU_DESCRIPTOR_SIZE (9 + 9) // Interface and functional descriptor
+
+// Fills the entry for USBDCompositeInit, like the usblib class drivers' CompositeInit
+extern void *dfuCompositeInit(tCompositeEntry *compositeEntry);
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "inc/hw_flash.h"
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/rom.h"
+#include "driverlib/usb.h"
+#include "usblib/usblib.h"
+#include "usblib/usb-ids.h"
+#include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdcomp.h"
+
+#include "usb_vendor.h"
+#include "vendor_protocol.h"
+#include "bootctl.h"
+#include "common.h"
+#include "crc32.h"
+#include "ramdisk.h"
+#include "sched.h"
+
+// OUT packets go straight into the write queue, a block at a time. Replies to commands that
+// have to wait for the flash are sent from the main loop.
+static struct {
+	uint32_t inEndpoint;             // USB_EP_n, renumbered by the composite device
+	uint32_t outEndpoint;
+	VendorCommand command;           // The command in progress
+	unsigned long programmed;        // PROGRAM bytes queued so far, the data phase is on while less than the length
+	unsigned int blockFill;
+	unsigned char block[BLOCK_SIZE] __attribute__ ((aligned(4)));
+	VendorReply reply;
+	VendorInfo info;
+	bool replySent;                  // Then data is sent from sendData
+	const unsigned char *sendData;
+	unsigned long sendLength;
+	bool busy;                       // Sending, or the main loop is working on the command
+} vendor = {
+	.inEndpoint = USB_EP_1,
+	.outEndpoint = USB_EP_1,
+};
+
+static const uint8_t vendorDeviceDescriptor[] = {
+	18,                         // Size of this structure
+	USB_DTYPE_DEVICE,           // Type of this structure
+	USBShort(0x110),            // USB version 1.1
+	0, 0, 0,                    // Class, subclass and protocol are given by the interface
+	64,                         // Maximum packet size of endpoint 0
+	USBShort(USB_VID_TI_1CBE),  // Replaced by the composite device's
+	USBShort(USB_PID_BULK),
+	USBShort(0x0100),           // Device release number
+	1, 2, 3,                    // Manufacturer, product and serial number strings
+	1,                          // One configuration
+};
+
+static const uint8_t vendorConfigDescriptor[] = {
+	9,                          // Size of the config descriptor
+	USB_DTYPE_CONFIGURATION,    // Type of this descriptor
+	USBShort(9 + VENDOR_DESCRIPTOR_SIZE), // Total size of the configuration
+	1,                          // One interface
+	1,                          // Configuration value
+	0,                          // No string
+	USB_CONF_ATTR_SELF_PWR,
+	250,                        // 500 mA
+};
+
+static const uint8_t vendorInterface[VENDOR_DESCRIPTOR_SIZE] = {
+	// Interface descriptor, the interface and endpoint numbers are set by the composite device
+	9,                          // Size of the interface descriptor
+	USB_DTYPE_INTERFACE,        // Type of this descriptor
+	0,                          // Interface number
+	0,                          // Alternate setting
+	2,                          // Two endpoints
+	USB_CLASS_VEND_SPECIFIC,    // Vendor specific, for WinUSB or libusb
+	0,
+	0,
+	0,                          // No string
+
+	7,                          // Size of the endpoint descriptor
+	USB_DTYPE_ENDPOINT,         // Type of this descriptor
+	USB_EP_DESC_IN | USBEPToIndex(USB_EP_1),
+	USB_EP_ATTR_BULK,
+	USBShort(VENDOR_PACKET_SIZE),
+	0,                          // Not polled
+
+	7,                          // Size of the endpoint descriptor
+	USB_DTYPE_ENDPOINT,         // Type of this descriptor
+	USB_EP_DESC_OUT | USBEPToIndex(USB_EP_1),
+	USB_EP_ATTR_BULK,
+	USBShort(VENDOR_PACKET_SIZE),
+	0,                          // Not polled
+};
+
+static const tConfigSection vendorConfigSection = { sizeof(vendorConfigDescriptor), vendorConfigDescriptor };
+static const tConfigSection vendorInterfaceSection = { sizeof(vendorInterface), vendorInterface };
+static const tConfigSection * const vendorSections[] = { &vendorConfigSection, &vendorInterfaceSection };
+static const tConfigHeader vendorConfigHeader = { sizeof(vendorSections) / sizeof(vendorSections[0]), vendorSections };
+static const tConfigHeader * const vendorConfigDescriptors[] = { &vendorConfigHeader };
+
+// Puts the next packet of the reply and the data after it into the IN endpoint, from the
+// USB interrupt or with interrupts masked
+static void vendorSendNext(void)
+{
+	if (!vendor.replySent) {
+		vendor.replySent = true;
+		USBEndpointDataPut(USB0_BASE, vendor.inEndpoint, (uint8_t *)&vendor.reply, sizeof(vendor.reply));
+	}
+	else if (vendor.sendLength) {
+		const unsigned long size = vendor.sendLength < VENDOR_PACKET_SIZE ? vendor.sendLength : VENDOR_PACKET_SIZE;
+		USBEndpointDataPut(USB0_BASE, vendor.inEndpoint, (uint8_t *)vendor.sendData, size);
+		vendor.sendData += size;
+		vendor.sendLength -= size;
+	}
+	else {
+		// All sent
+		vendor.busy = false;
+		if (vendor.command.command == VENDOR_BOOT && vendor.reply.status == VENDOR_OK)
+			uploadEnd();
+		return;
+	}
+	USBEndpointDataSend(USB0_BASE, vendor.inEndpoint, USB_TRANS_IN);
+}
+
+static void vendorReply(uint32_t status, uint32_t value, const void *data, unsigned long length)
+{
+	vendor.reply.magic = VENDOR_MAGIC;
+	vendor.reply.command = vendor.command.command;
+	vendor.reply.status = status;
+	vendor.reply.value = value;
+	vendor.replySent = false;
+	vendor.sendData = data;
+	vendor.sendLength = status == VENDOR_OK ? length : 0;
+	vendor.busy = true;
+	vendorSendNext();
+}
+
+// vendorReply for the tasks, which run with the USB interrupt enabled
+static void vendorReplyFromTask(uint32_t status, uint32_t value, const void *data, unsigned long length)
+{
+	const bool masked = ROM_IntMasterDisable();
+	vendorReply(status, value, data, length);
+	if (!masked)
+		ROM_IntMasterEnable();
+}
+
+static bool inUploadSlot(uint32_t address, uint32_t length)
+{
+	return address >= uploadSlot() && length <= SLOT_LENGTH && address - uploadSlot() <= SLOT_LENGTH - length;
+}
+
+#ifndef NOREAD
+// READ and CRC only see the images, never the bootloader with its keys or anything else
+static bool inSlots(uint32_t address, uint32_t length)
+{
+	return inUploadSlot(address, length) ||
+	       (address >= activeSlot() && length <= SLOT_LENGTH && address - activeSlot() <= SLOT_LENGTH - length);
+}
+#endif
+
+static void vendorErase(void)
+{
+	uploadFlush();
+	uploadErase(vendor.command.address - uploadSlot(), vendor.command.length);
+	vendorReplyFromTask(VENDOR_OK, 0, 0, 0);
+}
+
+#ifndef NOREAD
+static void vendorRead(void)
+{
+	// Programs what is queued first, so reads see the last PROGRAM
+	uploadFlush();
+	vendorReplyFromTask(VENDOR_OK, 0, (const void *)(unsigned long)vendor.command.address, vendor.command.length);
+}
+
+static void vendorCrc(void)
+{
+	uploadFlush();
+	vendorReplyFromTask(VENDOR_OK, crc32Update(0, (const void *)(unsigned long)vendor.command.address, vendor.command.length), 0, 0);
+}
+#endif
+
+static void vendorCommand(void)
+{
+	const VendorCommand *command = &vendor.command;
+
+	switch (command->command) {
+	case VENDOR_INFO:
+		vendor.info.uploadSlot = uploadSlot();
+		vendor.info.activeSlot = activeSlot();
+		vendor.info.slotLength = SLOT_LENGTH;
+		vendor.info.eraseSize = FLASH_ERASE_SIZE;
+		vendorReply(VENDOR_OK, 0, &vendor.info, sizeof(vendor.info));
+		return;
+	case VENDOR_ERASE:
+		if (!inUploadSlot(command->address, command->length))
+			break;
+		vendor.busy = true;
+		schedPost(vendorErase);
+		return;
+	case VENDOR_PROGRAM:
+		if (!inUploadSlot(command->address, command->length) || (command->address - uploadSlot()) % BLOCK_SIZE ||
+		    command->length % BLOCK_SIZE || (command->address != uploadSlot() && !newFirmwareStartSet))
+			break;
+		// The data phase, answered once the last block is queued
+		vendor.programmed = 0;
+		vendor.blockFill = 0;
+		if (command->length == 0)
+			vendorReply(VENDOR_OK, 0, 0, 0);
+		return;
+#ifdef NOREAD
+	case VENDOR_READ:
+	case VENDOR_CRC:
+		// The CRC32 of short ranges gives the bytes away just as well as reading them
+		vendorReply(VENDOR_NOT_SUPPORTED, 0, 0, 0);
+		return;
+#else
+	case VENDOR_READ:
+		if (!inSlots(command->address, command->length))
+			break;
+		vendor.busy = true;
+		schedPost(vendorRead);
+		return;
+	case VENDOR_CRC:
+		if (!inSlots(command->address, command->length))
+			break;
+		vendor.busy = true;
+		schedPost(vendorCrc);
+		return;
+#endif
+	case VENDOR_BOOT:
+		vendorReply(VENDOR_OK, 0, 0, 0);
+		return;
+	default:
+		vendorReply(VENDOR_BAD_COMMAND, 0, 0, 0);
+		return;
+	}
+	vendorReply(VENDOR_BAD_RANGE, 0, 0, 0);
+}
+
+// A PROGRAM data packet, the block goes to the write queue once it is complete
+static void vendorProgram(const unsigned char *packet, uint32_t size)
+{
+	for (uint32_t i = 0; i < size && vendor.blockFill < BLOCK_SIZE; i++)
+		vendor.block[vendor.blockFill++] = packet[i];
+	if (vendor.blockFill < BLOCK_SIZE)
+		return;
+
+	const unsigned long offset = vendor.command.address - uploadSlot() + vendor.programmed;
+	vendor.blockFill = 0;
+	if (offset == 0) {
+		if (!isFirmwareStart(vendor.block)) {
+			vendor.programmed = vendor.command.length;
+			vendorReply(VENDOR_BAD_IMAGE, 0, 0, 0);
+			return;
+		}
+		uploadBegin(vendor.block);
+	}
+	// The queue cannot be full here, vendorReceive holds a packet back while it is
+	if (!uploadBlock(offset, vendor.block)) {
+		vendor.programmed = vendor.command.length;
+		vendorReply(VENDOR_WRITE_FAILED, 0, 0, 0);
+		return;
+	}
+	vendor.programmed += BLOCK_SIZE;
+	if (vendor.programmed == vendor.command.length)
+		vendorReply(VENDOR_OK, 0, 0, 0);
+}
+
+static void vendorResume(void);
+
+static void vendorReceive(void)
+{
+	unsigned char packet[VENDOR_PACKET_SIZE] __attribute__ ((aligned(4)));
+	uint32_t size = sizeof(packet);
+
+	if (vendor.command.command == VENDOR_PROGRAM && vendor.programmed < vendor.command.length &&
+	    vendor.blockFill + VENDOR_PACKET_SIZE >= BLOCK_SIZE && uploadBusy()) {
+		// The packet may complete a block and the write queue is full. It stays in the
+		// endpoint FIFO, so the host is NAKed, until vendorResume takes it.
+		schedPost(vendorResume);
+		return;
+	}
+
+	USBEndpointDataGet(USB0_BASE, vendor.outEndpoint, packet, &size);
+	USBDevEndpointDataAck(USB0_BASE, vendor.outEndpoint, true);
+
+	if (vendor.command.command == VENDOR_PROGRAM && vendor.programmed < vendor.command.length) {
+		vendorProgram(packet, size);
+	}
+	else if (!vendor.busy && size == sizeof(VendorCommand)) {
+		const VendorCommand *command = (const VendorCommand *)packet;
+		vendor.command = *command;
+		if (command->magic != VENDOR_MAGIC)
+			vendorReply(VENDOR_BAD_COMMAND, 0, 0, 0);
+		else
+			vendorCommand();
+	}
+	// Anything else is dropped, the host resynchronizes by reading the pending reply
+}
+
+// A task, for the packet that vendorReceive left in the FIFO
+static void vendorResume(void)
+{
+	const bool masked = ROM_IntMasterDisable();
+	vendorReceive();
+	if (!masked)
+		ROM_IntMasterEnable();
+}
+
+static void vendorEndpoint(void *instance, uint32_t status)
+{
+	// OUT endpoints are in the upper 16 bits
+	if (status & (0x10000 << USBEPToIndex(vendor.outEndpoint)))
+		vendorReceive();
+	if (status & (1 << USBEPToIndex(vendor.inEndpoint)))
+		vendorSendNext();
+}
+
+static void vendorDevice(void *instance, uint32_t request, void *requestData)
+{
+	const uint8_t *endpoints = requestData;
+
+	// The composite device moves the endpoints so they do not clash with mass storage
+	if (request == USB_EVENT_COMP_EP_CHANGE) {
+		if (endpoints[0] & USB_EP_DESC_IN)
+			vendor.inEndpoint = IndexToUSBEP(endpoints[1] & 0x7F);
+		else
+			vendor.outEndpoint = IndexToUSBEP(endpoints[1] & 0x7F);
+	}
+}
+
+static const tCustomHandlers vendorHandlers = {
+	.pfnEndpointHandler = vendorEndpoint,
+	.pfnDeviceHandler = vendorDevice,
+};
+
+static tDeviceInfo vendorDeviceInfo = {
+	.psCallbacks = &vendorHandlers,
+	.pui8DeviceDescriptor = vendorDeviceDescriptor,
+	.ppsConfigDescriptors = vendorConfigDescriptors,
+};
+
+void *vendorCompositeInit(tCompositeEntry *compositeEntry)
+{
+	compositeEntry->psDevInfo = &vendorDeviceInfo;
+	compositeEntry->pvInstance = &vendor;
+	return &vendor;
+}
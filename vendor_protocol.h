@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef __VENDOR_PROTOCOL_H__
+#define __VENDOR_PROTOCOL_H__
+
+#include <stdint.h>
+
+// The protocol of the vendor specific bulk interface (VENDOR=1), shared with the host
+// client in tools/bulkflash.cpp.
+//
+// The host sends a VendorCommand on the bulk OUT endpoint and the device answers with a
+// VendorReply on the bulk IN endpoint. PROGRAM is followed by its data on the OUT
+// endpoint and answered once all of it has been taken, INFO and READ are followed by
+// their data on the IN endpoint after the reply. Addresses are flash addresses, ERASE
+// and PROGRAM only accept the slot that uploads go to (VendorInfo.uploadSlot). All
+// fields are little endian.
+
+#define VENDOR_MAGIC (0x4C425354) // "TSBL"
+
+#define VENDOR_INFO    (0) // VendorInfo follows the reply
+#define VENDOR_ERASE   (1) // Erases the pages from address to address + length
+#define VENDOR_PROGRAM (2) // length bytes follow, a multiple of VENDOR_BLOCK_SIZE
+#define VENDOR_READ    (3) // length bytes follow the reply, the range must be in the upload or the active slot
+#define VENDOR_CRC     (4) // The reply's value is the CRC32 (as zlib's) of the range, as for READ
+#define VENDOR_BOOT    (5) // Programs what is left and starts the new image
+
+#define VENDOR_OK            (0)
+#define VENDOR_BAD_COMMAND   (1)
+#define VENDOR_BAD_RANGE     (2)
+#define VENDOR_NOT_SUPPORTED (3) // READ and CRC in a NOREAD build
+#define VENDOR_BAD_IMAGE     (4) // The first block of PROGRAM is not the start of an image
+#define VENDOR_WRITE_FAILED  (5) // A block of PROGRAM could not be queued, the rest of it was dropped
+
+#define VENDOR_PACKET_SIZE (64)  // Full speed bulk endpoints
+#define VENDOR_BLOCK_SIZE  (512) // PROGRAM addresses and lengths are multiples of this
+
+typedef struct {
+	uint32_t magic;
+	uint32_t command;
+	uint32_t address;
+	uint32_t length;
+} VendorCommand;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t command; // The command this answers
+	uint32_t status;
+	uint32_t value;   // The CRC32 for VENDOR_CRC, 0 otherwise
+} VendorReply;
+
+typedef struct {
+	uint32_t uploadSlot;  // Where PROGRAM goes
+	uint32_t activeSlot;  // The image that runs now
+	uint32_t slotLength;
+	uint32_t eraseSize;   // Flash page size
+} VendorInfo;
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "verify.h"
+#include "bootctl.h"
+#include "common.h"
+#include "crc32.h"
+#include "ramdisk.h"
+#include "sched.h"
+#include "crypto/sha256.h"
+
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/rom.h"
+
+#define VERIFY_LINE_LENGTH 96 // Longer requests are cut off
+
+// The last request and the reply to it. The USB interrupt stores a request and counts it,
+// the task answers the request it took unless a newer one has arrived in the meantime.
+static char request[VERIFY_LINE_LENGTH];
+static char reply[VERIFY_LINE_LENGTH] = "ready\n";
+static volatile uint32_t requests, answered;
+
+static const char *skipSpaces(const char *text)
+{
+	while (*text == ' ' || *text == '\t')
+		text++;
+	return text;
+}
+
+// A number in hex with 0x or in decimal, returns 0 at anything else
+static const char *parseNumber(const char *text, uint32_t *value)
+{
+	const unsigned int base = text[0] == '0' && (text[1] == 'x' || text[1] == 'X') ? 16 : 10;
+	const char *start = text = base == 16 ? text + 2 : text;
+	*value = 0;
+	for (;; text++) {
+		unsigned int digit;
+		if (*text >= '0' && *text <= '9')
+			digit = *text - '0';
+		else if (base == 16 && (*text | 0x20) >= 'a' && (*text | 0x20) <= 'f')
+			digit = (*text | 0x20) - 'a' + 10;
+		else
+			break;
+		*value = *value * base + digit;
+	}
+	return text == start ? 0 : text;
+}
+
+static char *appendText(char *line, const char *text)
+{
+	while (*text)
+		*line++ = *text++;
+	return line;
+}
+
+static char *appendHex(char *line, uint32_t value, int digits)
+{
+	while (digits--)
+		*line++ = "0123456789abcdef"[(value >> (4 * digits)) & 0x0F];
+	return line;
+}
+
+// Only the images can be asked about, never the bootloader with its keys or anything else
+static bool inSlot(unsigned long slot, uint32_t address, uint32_t length)
+{
+	return address >= slot && length <= SLOT_LENGTH && address - slot <= SLOT_LENGTH - length;
+}
+
+// Answers request into line
+static void verifyAnswer(const char *line, char *answer)
+{
+	const bool sha256 = strncmp(line, "sha256 ", 7) == 0;
+	uint32_t address, length;
+	const char *text = sha256 ? line + 7 : strncmp(line, "crc32 ", 6) == 0 ? line + 6 : 0;
+	if (!text) {
+		strcpy(answer, "error unknown request\n");
+		return;
+	}
+	if (!(text = parseNumber(skipSpaces(text), &address)) || !(text = parseNumber(skipSpaces(text), &length)) || (!inSlot(uploadSlot(), address, length) && !inSlot(activeSlot(), address, length))) {
+		strcpy(answer, "error bad range\n");
+		return;
+	}
+
+	// The blocks the host wrote last may still be queued
+	uploadFlush();
+	answer = appendText(answer, sha256 ? "sha256 0x" : "crc32 0x");
+	answer = appendHex(answer, address, 8);
+	answer = appendText(answer, " 0x");
+	answer = appendHex(answer, length, 8);
+	answer = appendText(answer, " ");
+	if (sha256) {
+		SHA256_State state;
+		unsigned char digest[32];
+		SHA256_Init(&state);
+		SHA256_Bytes(&state, (const void *)(unsigned long)address, length);
+		SHA256_Final(&state, digest);
+		for (int i = 0; i < sizeof(digest); i++)
+			answer = appendHex(answer, digest[i], 2);
+	}
+	else {
+		answer = appendHex(answer, crc32Update(0, (const void *)(unsigned long)address, length), 8);
+	}
+	appendText(answer, "\n");
+}
+
+static void verifyTask(void)
+{
+	char line[VERIFY_LINE_LENGTH], answer[VERIFY_LINE_LENGTH] = { 0 };
+
+	bool masked = ROM_IntMasterDisable();
+	const uint32_t number = requests;
+	memcpy(line, request, sizeof(line));
+	if (!masked)
+		ROM_IntMasterEnable();
+
+	verifyAnswer(line, answer);
+
+	masked = ROM_IntMasterDisable();
+	if (requests == number) {
+		memcpy(reply, answer, sizeof(reply));
+		answered = number;
+	}
+	if (!masked)
+		ROM_IntMasterEnable();
+}
+
+void verifyWrite(const unsigned char *data)
+{
+	// The first line, without the line end
+	int i;
+	for (i = 0; i < VERIFY_LINE_LENGTH - 1 && data[i] && data[i] != '\r' && data[i] != '\n'; i++)
+		request[i] = data[i];
+	request[i] = 0;
+	requests++;
+	schedPost(verifyTask);
+}
+
+void verifyRead(unsigned char *data)
+{
+	char *line = appendText((char *)data, "upload 0x");
+	line = appendHex(line, newFirmwareStartSet ? uploadStart : uploadSlot(), 8);
+	line = appendText(line, " 0x");
+	line = appendHex(line, SLOT_LENGTH, 8);
+	line = appendText(line, "\n");
+	appendText(line, answered == requests ? reply : "busy\n");
+}
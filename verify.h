@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2017 The TM4C-MSC-bootloader authors, see AUTHORS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+// VERIFY.TXT, built in with VERIFY, is a one block file on the drive through which the
+// host asks for a digest of a flash range instead of reading it back. The host writes a
+// line "crc32 <address> <length>" or "sha256 <address> <length>" into it, numbers in hex
+// with 0x or in decimal, and reads it back: the first line gives the upload slot and its
+// length, the second "busy" until the digest is computed and then the request with it.
+// The range must be in the upload or the active slot. Both are called from the USB
+// interrupt, the digest is computed in the main loop.
+extern void verifyWrite(const unsigned char *data);
+extern void verifyRead(unsigned char *data);
+
+#endif